@@ -0,0 +1,313 @@
+// Power management system CAN bootloader
+// Copyright 2016, McMaster Solar Car Project
+// Resident below the PMS application, starts it or loads a new image over
+// CAN bus, see pms_boot.h for the memory map and the protocol.
+//
+// This is a program of its own, build it separately from main.c and program
+// it once with the PICkit together with a first application image. From then
+// on the application is updated with tools/pms_flash.c. The loader runs with
+// interrupts disabled and polls the CAN receive FIFO, it only handles frames
+// on COMMAND_PMS_BOOT.
+
+// Includes
+#define _bootloader
+#include "main.h"
+#include "can_telem.h"
+#include "pms_boot.h"
+#include "can18F4580_mscp.c"
+
+// The application area, the loader must fit below it
+#org BOOT_APP_START, BOOT_APP_END {}
+
+#byte EECON1 = getenv("SFR:EECON1")     //0xF7F
+#bit  EECON1_WR = EECON1.1              // Set while a data EEPROM write is in progress
+
+// CAN bus defines
+#define TX_PRI 3
+#define TX_EXT 0
+#define TX_RTR 0
+
+static int8  g_block[BOOT_BLOCK_FRAMES * 7 - 2]; // Block being received
+static int16 g_block_number;
+static int16 g_block_frames;                     // Bit n set once frame n of the block has arrived
+static int16 g_image_len;
+static int16 g_image_crc;
+static int1  gb_updating;                        // BOOT_OP_START received
+
+// The application's interrupts arrive at the hardware vectors in the loader
+#int_global
+void isr(void)
+{
+    jump_to_isr(BOOT_APP_START + 0x08);
+}
+
+// Sends a response on RESPONSE_PMS_BOOT
+void boot_reply(int8 op, int8 status, int16 arg)
+{
+    int8 frame[4];
+
+    frame[0] = op;
+    frame[1] = status;
+    frame[2] = make8(arg,0);
+    frame[3] = make8(arg,1);
+    while (!can_tbe())
+    {
+    }
+    can_putd(RESPONSE_PMS_BOOT_ID,frame,4,TX_PRI,TX_EXT,TX_RTR);
+}
+
+void boot_ready(int8 reason)
+{
+    int8 frame[5];
+
+    frame[0] = BOOT_OP_READY;
+    frame[1] = BOOT_OK;
+    frame[2] = BOOT_VERSION;
+    frame[3] = reason;
+    frame[4] = BOOT_BLOCK_SIZE;
+    while (!can_tbe())
+    {
+    }
+    can_putd(RESPONSE_PMS_BOOT_ID,frame,5,TX_PRI,TX_EXT,TX_RTR);
+}
+
+// Writes a byte of the boot record and waits for the write to finish
+void boot_record_write(int8 offset, int8 value)
+{
+    write_eeprom(BOOT_RECORD + offset,value);
+    while (EECON1_WR == 1)
+    {
+    }
+}
+
+// CRC-16/CCITT of one more byte
+int16 crc16(int16 crc, int8 data)
+{
+    int8 i;
+
+    crc ^= (int16)data << 8;
+    for (i = 0 ; i < 8 ; i++)
+    {
+        if (bit_test(crc,15))
+        {
+            crc = (crc << 1) ^ 0x1021;
+        }
+        else
+        {
+            crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+// Starts an update of len bytes with the given CRC
+void boot_start(int8 * data, int8 len)
+{
+    int16 image_len;
+
+    image_len = (len >= 5) ? make16(data[2],data[1]) : 0;
+    if ((image_len == 0) || (image_len > (BOOT_APP_END - BOOT_APP_START + 1)))
+    {
+        boot_reply(BOOT_OP_START,BOOT_BAD_BLOCK,image_len);
+        return;
+    }
+
+    // Anything from here on leaves the PMS in the loader until the update
+    // has been finished
+    boot_record_write(BOOT_RECORD_IMAGE,0xFF);
+    g_image_len    = image_len;
+    g_image_crc    = make16(data[4],data[3]);
+    g_block_frames = 0;
+    gb_updating    = true;
+    boot_reply(BOOT_OP_START,BOOT_OK,image_len);
+}
+
+// Takes a data frame, writes the block once all of its frames are in
+void boot_data(int8 * data, int8 len)
+{
+    int8  i;
+    int8  n;
+    int32 addr;
+
+    n = data[0] & 0x7F;
+    if ((n >= BOOT_BLOCK_FRAMES) || (len < 8))
+    {
+        return;
+    }
+
+    if (n == 0)
+    {
+        if (g_block_frames != 0)
+        {
+            boot_reply(BOOT_OP_DATA,BOOT_INCOMPLETE,g_block_number);
+        }
+        g_block_number = make16(data[2],data[1]);
+        for (i = 0 ; i < 5 ; i++)
+        {
+            g_block[i] = data[i + 3];
+        }
+        g_block_frames = 1;
+    }
+    else if (g_block_frames != 0)
+    {
+        for (i = 0 ; i < 7 ; i++)
+        {
+            g_block[7 * n - 2 + i] = data[i + 1];
+        }
+        bit_set(g_block_frames,n);
+    }
+    else
+    {
+        // Frame 0 was lost, the host resends the block when it is not acknowledged
+        return;
+    }
+
+    if (g_block_frames != ((1 << BOOT_BLOCK_FRAMES) - 1))
+    {
+        return;
+    }
+    g_block_frames = 0;
+
+    if (gb_updating == false)
+    {
+        boot_reply(BOOT_OP_DATA,BOOT_BAD_STATE,g_block_number);
+        return;
+    }
+    addr = BOOT_APP_START + (int32)g_block_number * BOOT_BLOCK_SIZE;
+    if (((int32)g_block_number * BOOT_BLOCK_SIZE >= g_image_len) || (addr > (BOOT_APP_END - BOOT_BLOCK_SIZE + 1)))
+    {
+        boot_reply(BOOT_OP_DATA,BOOT_BAD_BLOCK,g_block_number);
+        return;
+    }
+
+    // The address is the start of an erase block, so the block is erased
+    // before it is written. The CPU stalls for both while the CAN module
+    // keeps receiving the next block into its FIFO.
+    write_program_memory(addr,g_block,BOOT_BLOCK_SIZE);
+    boot_reply(BOOT_OP_DATA,BOOT_OK,g_block_number);
+}
+
+// Checks the image written against its CRC and validates the boot record
+void boot_finish(void)
+{
+    int8  i;
+    int32 offset;
+    int16 crc;
+
+    if (gb_updating == false)
+    {
+        boot_reply(BOOT_OP_FINISH,BOOT_BAD_STATE,0);
+        return;
+    }
+
+    crc = 0xFFFF;
+    for (offset = 0 ; offset < g_image_len ; offset += BOOT_BLOCK_SIZE)
+    {
+        read_program_memory(BOOT_APP_START + offset,g_block,BOOT_BLOCK_SIZE);
+        for (i = 0 ; (i < BOOT_BLOCK_SIZE) && ((offset + i) < g_image_len) ; i++)
+        {
+            crc = crc16(crc,g_block[i]);
+        }
+    }
+    if (crc != g_image_crc)
+    {
+        boot_reply(BOOT_OP_FINISH,BOOT_BAD_CRC,crc);
+        return;
+    }
+
+    // The image is only made valid once the rest of the record is written
+    boot_record_write(BOOT_RECORD_LEN,make8(g_image_len,0));
+    boot_record_write(BOOT_RECORD_LEN + 1,make8(g_image_len,1));
+    boot_record_write(BOOT_RECORD_CRC,make8(crc,0));
+    boot_record_write(BOOT_RECORD_CRC + 1,make8(crc,1));
+    boot_record_write(BOOT_RECORD_REQUEST,0xFF);
+    boot_record_write(BOOT_RECORD_IMAGE,BOOT_IMAGE_VALID);
+    gb_updating = false;
+    boot_reply(BOOT_OP_FINISH,BOOT_OK,crc);
+}
+
+// Main
+void main()
+{
+    int8   reason;
+    int32  id;
+    int8   data[8];
+    int8   len;
+    struct rx_stat stat;
+
+    reason = 0;
+    if (read_eeprom(BOOT_RECORD + BOOT_RECORD_REQUEST) == BOOT_REQUEST_ENTER)
+    {
+        reason = BOOT_REASON_REQUEST;
+    }
+    else if (read_eeprom(BOOT_RECORD + BOOT_RECORD_IMAGE) != BOOT_IMAGE_VALID)
+    {
+        reason = BOOT_REASON_NO_IMAGE;
+    }
+    if (reason == 0)
+    {
+        // Nothing to do, this is every normal power up
+        goto_address(BOOT_APP_START);
+    }
+
+    // Keep every relay open while the loader runs
+    output_low(HORN_PIN);
+    output_low(PRECHARGE_PIN);
+    output_low(MOTOR_PIN);
+    output_low(MPPT_PIN);
+    output_low(AUX_READ_PIN);
+
+    while (can_init() == false)
+    {
+        // Nothing to do without the bus, keep trying
+    }
+    gb_updating    = false;
+    g_block_frames = 0;
+    boot_ready(reason);
+    if (reason == BOOT_REASON_REQUEST)
+    {
+        // The request has been answered, a session that ends without an
+        // update leaves the image as it was and the application starts at
+        // the next reset
+        boot_record_write(BOOT_RECORD_REQUEST,0xFF);
+    }
+
+    while(true)
+    {
+        if (!can_kbhit() || !can_getd(id,data,len,stat))
+        {
+            continue;
+        }
+        if ((id != COMMAND_PMS_BOOT_ID) || (len == 0))
+        {
+            continue;
+        }
+
+        if ((data[0] & BOOT_OP_DATA) != 0)
+        {
+            boot_data(data,len);
+            continue;
+        }
+        switch(data[0])
+        {
+            case BOOT_OP_ENTER:
+                // Already here, the host may have missed BOOT_OP_READY
+                boot_ready(BOOT_REASON_COMMAND);
+                break;
+            case BOOT_OP_START:
+                boot_start(data,len);
+                break;
+            case BOOT_OP_FINISH:
+                boot_finish();
+                break;
+            case BOOT_OP_RUN:
+                boot_reply(BOOT_OP_RUN,BOOT_OK,0);
+                delay_ms(5); // Let the response go out
+                reset_cpu();
+                break;
+            default:
+                boot_reply(data[0],BOOT_BAD_OP,0);
+                break;
+        }
+    }
+}
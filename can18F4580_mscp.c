@@ -12,6 +12,11 @@
 ////                                                                 ////
 ////    can_set_mode - Sets the CAN module into a specific mode*     ////
 ////                                                                 ////
+////    can_config_begin - Enters configuration mode for a batch of  ////
+////                       register changes*                         ////
+////                                                                 ////
+////    can_config_end - Restores the mode left by can_config_begin* ////
+////                                                                 ////
 ////     can_set_functional_mode - Sets the function mode            ////
 ////                                                                 ////
 ////    can_set_id - Sets the standard and extended ID*              ////
@@ -104,6 +109,24 @@
 ////                                                                 ////
 ////  Mar 24 11 - updated for new PIC18FxxK80 chips                  ////
 ////                                                                 ////
+////  Oct 18 26 - CAN_DO_DEBUG logs binary records through          ////
+////              can_dlog.c instead of printf                       ////
+////                                                                 ////
+////  Oct 18 26 - can_set_mode() gives up after CAN_MODE_TIMEOUT and ////
+////              returns FALSE instead of waiting forever, added    ////
+////              can_config_begin() and can_config_end() so a batch ////
+////              of filter and buffer changes takes one trip        ////
+////              through configuration mode, can_init() takes two   ////
+////              mode changes instead of four and returns FALSE if  ////
+////              the module did not reach normal mode               ////
+////                                                                 ////
+////  Oct 18 26 - can_init() sets the masks and filters from compile ////
+////              time register images with can_set_const_id()       ////
+////                                                                 ////
+////  Oct 18 26 - can_associate_filter_to_buffer() and               ////
+////              can_associate_filter_to_mask() index RXFBCON0 and  ////
+////              MSEL0 instead of casting an address to a pointer   ////
+////                                                                 ////
 /////////////////////////////////////////////////////////////////////////
 ////        (C) Copyright 1996,2011 Custom Computer Services         ////
 //// This source code may only be used by licensed users of the CCS  ////
@@ -118,15 +141,14 @@
 
 #if CAN_DO_DEBUG
  #use rs232(baud=9600, xmit=PIN_C6, rcv=PIN_C7)
- #define can_debug printf
-#else
- #define can_debug
+ #include "can_dlog.c"
 #endif
 
 //macros
 #define can_kbhit() (RXB0CON.rxful || RXB1CON.rxful || (B0CONR.rxful && !BSEL0.b0txen) || (B1CONR.rxful && !BSEL0.b1txen) || (B2CONR.rxful && !BSEL0.b2txen) || (B3CONR.rxful && !BSEL0.b3txen) || (B4CONR.rxful && !BSEL0.b4txen) || (B5CONR.rxful && !BSEL0.b5txen))
 #define can_tbe() (!TXB0CON.txreq || !TXB1CON.txreq || !TXB2CON.txreq || (!B0CONT.txreq && BSEL0.b0txen) || (!B1CONT.txreq && BSEL0.b1txen) || (!B2CONT.txreq && BSEL0.b2txen) || (!B3CONT.txreq && BSEL0.b3txen) || (!B4CONT.txreq && BSEL0.b4txen) || (!B5CONT.txreq && BSEL0.b5txen))
 #define can_abort()                 (CANCON.abat=1)
+#define can_get_mode()              (CANSTAT.opmode)
 
 // current mode variable
 // used by many of the device drivers to prevent damage from the mode
@@ -134,6 +156,10 @@
 unsigned int curmode;
 unsigned int curfunmode;
 
+// nesting depth of can_config_begin(), the mode is only changed by the
+// outermost call
+unsigned int can_config_depth=0;
+
 ////////////////////////////////////////////////////////////////////////
 //
 // can_init()
@@ -150,9 +176,20 @@ unsigned int curfunmode;
 // These default values can be overwritten in the main code, but most
 // applications will be fine with these defaults.
 //
+// Everything, including the switch to enhanced FIFO mode, is set in a
+// single trip through configuration mode. The masks and filters are set from
+// register images worked out at compile time (can_set_const_id).
+//
+// Returns:
+//    int1 - TRUE if the module reached normal mode, FALSE if a mode change
+//           timed out (stuck bus or transceiver)
+//
 //////////////////////////////////////////////////////////////////////////////
-void can_init(void) {
-   can_set_mode(CAN_OP_CONFIG);   //must be in config mode before params can be set
+int1 can_init(void) {
+   int1 ok;
+
+   can_config_depth=0;
+   ok=can_set_mode(CAN_OP_CONFIG);   //must be in config mode before params can be set
    can_set_baud();
    curfunmode=CAN_FUN_OP_LEGACY;
 
@@ -172,31 +209,35 @@ void can_init(void) {
    CIOCON.tx2src=CAN_CANTX2_SOURCE;       //added for PIC18F6585/8585/6680/8680
    CIOCON.tx2en=CAN_ENABLE_CANTX2;        //added for PIC18F6585/8585/6680/8680
 
-   can_set_id(RX0MASK, CAN_MASK_ACCEPT_ALL, CAN_USE_EXTENDED_ID);  //set mask 0
-   can_set_id(RXFILTER0, 0, CAN_USE_EXTENDED_ID);  //set filter 0 of mask 0
-   can_set_id(RXFILTER1, 0, CAN_USE_EXTENDED_ID);  //set filter 1 of mask 0
+   can_set_const_id(RX0MASK, CAN_MASK_ACCEPT_ALL, CAN_USE_EXTENDED_ID);  //set mask 0
+   can_set_const_id(RXFILTER0, 0, CAN_USE_EXTENDED_ID);  //set filter 0 of mask 0
+   can_set_const_id(RXFILTER1, 0, CAN_USE_EXTENDED_ID);  //set filter 1 of mask 0
 
-   can_set_id(RX1MASK, CAN_MASK_ACCEPT_ALL, CAN_USE_EXTENDED_ID);  //set mask 1
-   can_set_id(RXFILTER2, 0, CAN_USE_EXTENDED_ID);  //set filter 0 of mask 1
-   can_set_id(RXFILTER3, 0, CAN_USE_EXTENDED_ID);  //set filter 1 of mask 1
-   can_set_id(RXFILTER4, 0, CAN_USE_EXTENDED_ID);  //set filter 2 of mask 1
-   can_set_id(RXFILTER5, 0, CAN_USE_EXTENDED_ID);  //set filter 3 of mask 1
+   can_set_const_id(RX1MASK, CAN_MASK_ACCEPT_ALL, CAN_USE_EXTENDED_ID);  //set mask 1
+   can_set_const_id(RXFILTER2, 0, CAN_USE_EXTENDED_ID);  //set filter 0 of mask 1
+   can_set_const_id(RXFILTER3, 0, CAN_USE_EXTENDED_ID);  //set filter 1 of mask 1
+   can_set_const_id(RXFILTER4, 0, CAN_USE_EXTENDED_ID);  //set filter 2 of mask 1
+   can_set_const_id(RXFILTER5, 0, CAN_USE_EXTENDED_ID);  //set filter 3 of mask 1
 
    // set dynamic filters
-   can_set_id(RXFILTER6, 0, CAN_USE_EXTENDED_ID);
-   can_set_id(RXFILTER7, 0, CAN_USE_EXTENDED_ID);
-   can_set_id(RXFILTER8, 0, CAN_USE_EXTENDED_ID);
-   can_set_id(RXFILTER9, 0, CAN_USE_EXTENDED_ID);
-   can_set_id(RXFILTER10, 0, CAN_USE_EXTENDED_ID);
-   can_set_id(RXFILTER11, 0, CAN_USE_EXTENDED_ID);
-   can_set_id(RXFILTER12, 0, CAN_USE_EXTENDED_ID);
-   can_set_id(RXFILTER13, 0, CAN_USE_EXTENDED_ID);
-   can_set_id(RXFILTER14, 0, CAN_USE_EXTENDED_ID);
-   can_set_id(RXFILTER15, 0, CAN_USE_EXTENDED_ID);
- 
-   can_set_mode(CAN_OP_NORMAL);
+   can_set_const_id(RXFILTER6, 0, CAN_USE_EXTENDED_ID);
+   can_set_const_id(RXFILTER7, 0, CAN_USE_EXTENDED_ID);
+   can_set_const_id(RXFILTER8, 0, CAN_USE_EXTENDED_ID);
+   can_set_const_id(RXFILTER9, 0, CAN_USE_EXTENDED_ID);
+   can_set_const_id(RXFILTER10, 0, CAN_USE_EXTENDED_ID);
+   can_set_const_id(RXFILTER11, 0, CAN_USE_EXTENDED_ID);
+   can_set_const_id(RXFILTER12, 0, CAN_USE_EXTENDED_ID);
+   can_set_const_id(RXFILTER13, 0, CAN_USE_EXTENDED_ID);
+   can_set_const_id(RXFILTER14, 0, CAN_USE_EXTENDED_ID);
+   can_set_const_id(RXFILTER15, 0, CAN_USE_EXTENDED_ID);
+
+   // still in config mode, so no extra trip through can_set_functional_mode()
    curfunmode=CAN_FUN_OP_ENHANCED_FIFO;
-   can_set_functional_mode(curfunmode);
+   ECANCON.mdsel=curfunmode;
+
+   if(!can_set_mode(CAN_OP_NORMAL))
+      ok=FALSE;
+   return(ok);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -326,15 +367,73 @@ void can_set_baud(void) {
 //
 //   The reqop bits do not immediatly change the mode of operation, the
     // three most significant bits in the CANSTAT register (opmode2:opmode0)
-// must change to reflect the actuall change in mode, therefore a while
-// statement is used to check if the CANSTAT opmode bits have changed to
-// reflect the passed in mode
+// must change to reflect the actuall change in mode, therefore the CANSTAT
+// opmode bits are polled until they reflect the passed in mode.
+//
+// Leaving normal mode waits for the frame on the bus to end and entering it
+// waits for 11 recessive bits, well under CAN_MODE_TIMEOUT on a working bus.
+// A bus held dominant or a dead transceiver never lets the mode change, so
+// the polling is bounded: every poll is 10us of delay_us(), which makes the
+// worst case CAN_MODE_TIMEOUT * 10us whatever the clock.
+//
+// Returns:
+//    int1 - TRUE if the module is in the requested mode, FALSE if it did
+//           not get there in time. The request stays pending, the module
+//           may still change mode later.
 //
 // More information can be found in the PIC18F4580 datasheet section 23.3
 ////////////////////////////////////////////////////////////////////////
-void can_set_mode(CAN_OP_MODE mode) {
+int1 can_set_mode(CAN_OP_MODE mode) {
+   unsigned int16 i;
+
    CANCON.reqop=mode;
-   while( (CANSTAT.opmode) != mode );
+   for(i=0;i<CAN_MODE_TIMEOUT;i++) {
+      if(CANSTAT.opmode==mode)
+         return(TRUE);
+      delay_us(10);
+   }
+   return(CANSTAT.opmode==mode);
+}
+
+////////////////////////////////////////////////////////////////////////
+//
+// can_config_begin
+// can_config_end
+//
+// Bracket a batch of configuration changes (filters, masks, buffer
+// assignments, RTR buffers) so they are all made in one trip through
+// configuration mode:
+//
+//    can_config_begin();
+//    can_enable_filter(RXF2EN);
+//    can_associate_filter_to_buffer(AB0,F2BP);
+//    can_associate_filter_to_mask(ACCEPTANCE_MASK_1,F2BP);
+//    can_config_end();
+//
+// The configuration functions of this driver call them as well, so called
+// on their own each still enters and leaves configuration mode, but inside
+// a batch they do not change the mode. Calls nest, only the outermost pair
+// changes the mode, can_config_end() restores the mode that was active
+// before can_config_begin().
+//
+// Returns:
+//    int1 - FALSE if a mode change timed out, see can_set_mode(). Always
+//           call can_config_end() after can_config_begin(), even if it
+//           failed.
+////////////////////////////////////////////////////////////////////////
+int1 can_config_begin(void) {
+   if(can_config_depth++ != 0)
+      return(TRUE);
+
+   curmode=CANSTAT.opmode;
+   return(can_set_mode(CAN_OP_CONFIG));
+}
+
+int1 can_config_end(void) {
+   if((can_config_depth == 0) || (--can_config_depth != 0))
+      return(TRUE);
+
+   return(can_set_mode(curmode));
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -395,13 +494,11 @@ void can_set_mode(CAN_OP_MODE mode) {
 ////////////////////////////////////////////////////////////////////////////////
 void can_set_functional_mode(CAN_FUN_OP_MODE mode)
 {
-   curmode=CANSTAT.opmode;
-
-   can_set_mode(CAN_OP_CONFIG);   //must be in config mode before params can be set
+   can_config_begin();   //must be in config mode before params can be set
    ECANCON.mdsel=mode;
    curfunmode=mode;
    
-   can_set_mode(curmode);
+   can_config_end();
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -717,7 +814,7 @@ int8 can_putd(int32 id, int8 *data, int8 len, int8 priority, int1 ext, int1 rtr)
    else 
    {
       #if CAN_DO_DEBUG
-         can_debug("\r\nCAN_PUTD() FAIL: NO OPEN TX BUFFERS\r\n");
+         can_dlog_write(DLOG_PUTD_FAIL, 0, 0);
       #endif
       return(0xFF);
    }
@@ -747,16 +844,7 @@ int8 can_putd(int32 id, int8 *data, int8 len, int8 priority, int1 ext, int1 rtr)
       ECANCON.ewin=RX0;
 
    #if CAN_DO_DEBUG
-            can_debug("\r\nCAN_PUTD(): BUFF=%U ID=%LX LEN=%U PRI=%U EXT=%U RTR=%U\r\n", port, id, len, priority, ext, rtr);
-            if ((len)&&(!rtr)) {
-               data-=len;
-               can_debug("  DATA = ");
-               for (i=0;i<len;i++) {
-                  can_debug("%X ",*data);
-                  data++;
-               }
-               can_debug("\r\n");
-            }
+      can_dlog_putd(port, id, data-len, len, priority, ext, rtr);
    #endif
 
    return(port);
@@ -917,7 +1005,7 @@ int1 can_getd(int32 &id, int8 *data, int8 &len, struct rx_stat &stat)
    else
    {
       #if CAN_DO_DEBUG
-         can_debug("\r\nFAIL ON CAN_GETD(): NO MESSAGE IN BUFFER\r\n");
+         can_dlog_write(DLOG_GETD_EMPTY, 0, 0);
       #endif
       return (0);
    }
@@ -985,19 +1073,7 @@ int1 can_getd(int32 &id, int8 *data, int8 &len, struct rx_stat &stat)
       ECANCON.ewin=RX0;
 
    #if CAN_DO_DEBUG
-      can_debug("\r\nCAN_GETD(): BUFF=%U ID=%LX LEN=%U OVF=%U ", stat.buffer, id, len, stat.err_ovfl);
-      can_debug("FILT=%U RTR=%U EXT=%U INV=%U", stat.filthit, stat.rtr, stat.ext, stat.inv);
-      if ((len)&&(!stat.rtr)) 
-      {
-         data-=len;
-         can_debug("\r\n    DATA = ");
-         for (i=0;i<len;i++) 
-         {
-            can_debug("%X ",*data);
-            data++;
-         }
-      }
-      can_debug("\r\n");
+      can_dlog_getd(id, data-len, len, stat);
    #endif
 
    return(1);
@@ -1205,9 +1281,7 @@ void can_load_rtr (PROG_BUFFER b, int8 *data, int8 len)
    int8 *ptr;
 
    //do no damage to the current mode;
-   curmode = CANSTAT.opmode;
-
-   can_set_mode(CAN_OP_CONFIG);
+   can_config_begin();
 
    if(bit_test(b,2))
    {
@@ -1239,8 +1313,10 @@ void can_load_rtr (PROG_BUFFER b, int8 *data, int8 len)
       ptr=&B5D0;
       B5DLCT=len;
    }
-   else
+   else {
+      can_config_end();
       return;
+   }
 
    for(;len>0;len--) {
       *ptr=*data;
@@ -1248,7 +1324,7 @@ void can_load_rtr (PROG_BUFFER b, int8 *data, int8 len)
       data++;
    }
 
-   can_set_mode(curmode);
+   can_config_end();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1272,15 +1348,13 @@ void can_enable_filter(int16 filter)
 {
    int16 *ptr;
 
-   curmode=CANSTAT.opmode;
-
-   can_set_mode(CAN_OP_CONFIG);
+   can_config_begin();
 
    ptr = &RXFCON0;
 
    *ptr|=filter;
 
-   can_set_mode(curmode);
+   can_config_end();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1304,15 +1378,13 @@ void can_disable_filter(int16 filter)
 {
    int16 *ptr;
 
-   curmode=CANSTAT.opmode;
-
-   can_set_mode(CAN_OP_CONFIG);
+   can_config_begin();
 
    ptr = &RXFCON0;
 
    *ptr&=~filter;
 
-   can_set_mode(curmode);
+   can_config_end();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1343,11 +1415,9 @@ void can_associate_filter_to_buffer(CAN_FILTER_ASSOCIATION_BUFFERS buffer, CAN_F
 {
    int8 *ptr;
 
-   curmode=CANSTAT.opmode;
-
-   can_set_mode(CAN_OP_CONFIG);
+   can_config_begin();
 
-   ptr=(filter>>1)|0x0DE0;
+   ptr=&RXFBCON0+(filter>>1);
 
    if((filter & 0x01) == 1)
    {
@@ -1360,7 +1430,7 @@ void can_associate_filter_to_buffer(CAN_FILTER_ASSOCIATION_BUFFERS buffer, CAN_F
       *ptr|=buffer;
    }
 
-   can_set_mode(curmode);
+   can_config_end();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1393,11 +1463,9 @@ void can_associate_filter_to_mask(CAN_MASK_FILTER_ASSOCIATE mask, CAN_FILTER_ASS
 {
    int8 *ptr;
 
-   curmode = CANSTAT.opmode;
-
-   can_set_mode(CAN_OP_CONFIG);
+   can_config_begin();
 
-   ptr=(filter>>2)|0x0DF0;
+   ptr=(int8 *)&msel0+(filter>>2);
 
    if((filter & 0x03)==0)
    {
@@ -1420,7 +1488,7 @@ void can_associate_filter_to_mask(CAN_MASK_FILTER_ASSOCIATE mask, CAN_FILTER_ASS
       *ptr|=mask<<6;
    }
 
-   can_set_mode(curmode);
+   can_config_end();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
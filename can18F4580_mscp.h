@@ -27,6 +27,10 @@
   #define CAN_USE_EXTENDED_ID         FALSE
 #ENDIF
 
+#ifndef CAN_MODE_TIMEOUT
+ #define CAN_MODE_TIMEOUT 500 //polls of CANSTAT, 10us apart, before can_set_mode() gives up (def: 5ms)
+#endif
+
 #IFNDEF CAN_BRG_SYNCH_JUMP_WIDTH
   #define CAN_BRG_SYNCH_JUMP_WIDTH  0  //synchronized jump width (def: 1 x Tq)
 #ENDIF
@@ -980,6 +984,23 @@ struct rxbNdlc_struct RXBaDLC;
 //value to put in mask field to accept all incoming id's
 #define CAN_MASK_ACCEPT_ALL   0
 
+//register images (xxxxSIDH, xxxxSIDL, xxxxEIDH, xxxxEIDL) of an id, the same
+//bytes can_set_id() works out at run time
+#define CAN_ID_SIDH(id,ext)   ((ext) ? (((id) >> 21) & 0xFF) : (((id) >> 3) & 0xFF))
+#define CAN_ID_SIDL(id,ext)   ((ext) ? ((((id) >> 16) & 0x03) | (((id) >> 13) & 0xE0) | 0x08) : (((id) << 5) & 0xE0))
+#define CAN_ID_EIDH(id,ext)   ((ext) ? (((id) >> 8) & 0xFF) : 0)
+#define CAN_ID_EIDL(id,ext)   ((ext) ? ((id) & 0xFF) : 0)
+
+//sets the registers of an id known at compile time, like can_set_id() but the
+//images fold to constants, so this is four register writes and no call
+#define can_set_const_id(addr,id,ext)                  \
+   {                                                   \
+      *((int8 *)(addr))=CAN_ID_EIDL(id,ext);           \
+      *((int8 *)(addr) - 1)=CAN_ID_EIDH(id,ext);       \
+      *((int8 *)(addr) - 2)=CAN_ID_SIDL(id,ext);       \
+      *((int8 *)(addr) - 3)=CAN_ID_SIDH(id,ext);       \
+   }
+
 //can interrupt flags
 #bit CAN_INT_IRXIF = getenv("BIT:IRXIF")     //0xFA4.7
 #bit CAN_INT_WAKIF = getenv("BIT:WAKIF")     //0xFA4.6
@@ -1001,9 +1022,11 @@ struct rx_stat {
    int1 inv;               // invalid id?
 };
 
-void  can_init(void);
+int1  can_init(void);
 void  can_set_baud(void);
-void  can_set_mode(CAN_OP_MODE mode);
+int1  can_set_mode(CAN_OP_MODE mode);
+int1  can_config_begin(void);
+int1  can_config_end(void);
 void  can_set_functional_mode(CAN_FUN_OP_MODE mode);
 void  can_set_id(int8 *addr, int32 id, int1 ext);
 int32 can_get_id(int8 *addr, int1 ext);
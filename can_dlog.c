@@ -0,0 +1,187 @@
+/////////////////////////////////////////////////////////////////////////
+////                          can_dlog.c                             ////
+////                                                                 ////
+//// Deferred binary logging used by can18F4580_mscp.c when          ////
+//// CAN_DO_DEBUG is TRUE (see can_dlog.h for the record format).    ////
+////                                                                 ////
+//// Log calls only copy a format ID and the raw arguments into a    ////
+//// ring buffer, which takes a few microseconds instead of the      ////
+//// milliseconds printf needs at 9600 baud. The UART transmit       ////
+//// interrupt drains the buffer in the background. When the buffer  ////
+//// is full new records are dropped and counted, and a DLOG_DROPPED ////
+//// record is written once there is room again.                     ////
+////                                                                 ////
+/////////////////////////////////////////////////////////////////////////
+
+#include "can_dlog.h"
+
+#ifndef CAN_DLOG_BUFFER_SIZE
+ #define CAN_DLOG_BUFFER_SIZE 128 //must be a power of 2, 256 at most
+#endif
+
+#define CAN_DLOG_MASK (CAN_DLOG_BUFFER_SIZE - 1)
+
+#bit CAN_DLOG_GIE = getenv("BIT:GIE")      //0xFF2.7
+
+int8 can_dlog_buffer[CAN_DLOG_BUFFER_SIZE];
+int8 can_dlog_head = 0;       //next byte to be written
+int8 can_dlog_tail = 0;       //next byte to be sent
+int8 can_dlog_dropped = 0;    //records dropped since the last DLOG_DROPPED
+
+////////////////////////////////////////////////////////////////////////
+//
+// can_dlog_free()
+//
+// Returns the number of free bytes in the ring buffer
+//
+////////////////////////////////////////////////////////////////////////
+int8 can_dlog_free(void) {
+   return((can_dlog_tail - can_dlog_head - 1) & CAN_DLOG_MASK);
+}
+
+////////////////////////////////////////////////////////////////////////
+//
+// can_dlog_put()
+//
+// Appends one byte to the ring buffer, the caller checks for room
+//
+////////////////////////////////////////////////////////////////////////
+void can_dlog_put(int8 b) {
+   can_dlog_buffer[can_dlog_head]=b;
+   can_dlog_head=(can_dlog_head+1) & CAN_DLOG_MASK;
+}
+
+////////////////////////////////////////////////////////////////////////
+//
+// can_dlog_write()
+//
+// Appends a record to the ring buffer and starts the UART draining it.
+// Called from both the main loop and the CAN receive interrupts, so the
+// record is written with interrupts disabled.
+//
+//    Parameters:
+//       fmt - format ID from DLOG_FORMAT_TABLE
+//       args - encoded arguments
+//       len - number of argument bytes
+//
+////////////////////////////////////////////////////////////////////////
+void can_dlog_write(int8 fmt, int8 *args, int8 len) {
+   int8 i;
+   int1 gie;
+
+   gie=CAN_DLOG_GIE;
+   CAN_DLOG_GIE=0;
+
+   if (can_dlog_dropped && (can_dlog_free() >= 3)) {
+      can_dlog_put(DLOG_SYNC);
+      can_dlog_put(DLOG_DROPPED);
+      can_dlog_put(can_dlog_dropped);
+      can_dlog_dropped=0;
+   }
+
+   if (can_dlog_free() < len + 2) {
+      if (can_dlog_dropped < 0xFF)
+         can_dlog_dropped++;
+   }
+   else {
+      can_dlog_put(DLOG_SYNC);
+      can_dlog_put(fmt);
+      for (i=0; i<len; i++)
+         can_dlog_put(args[i]);
+   }
+
+   enable_interrupts(INT_TBE);
+   CAN_DLOG_GIE=gie;
+}
+
+////////////////////////////////////////////////////////////////////////
+//
+// can_dlog_data()
+//
+// Logs a block of frame data as a DLOG_DATA record
+//
+////////////////////////////////////////////////////////////////////////
+void can_dlog_data(int8 *data, int8 len) {
+   int8 args[9];
+   int8 i;
+
+   if (len > 8)
+      len=8;
+
+   args[0]=len;
+   for (i=0; i<len; i++)
+      args[i+1]=data[i];
+
+   can_dlog_write(DLOG_DATA, args, len+1);
+}
+
+////////////////////////////////////////////////////////////////////////
+//
+// can_dlog_putd()
+//
+// Logs a frame queued by can_putd()
+//
+////////////////////////////////////////////////////////////////////////
+void can_dlog_putd(int8 port, int32 id, int8 *data, int8 len, int8 priority, int1 ext, int1 rtr) {
+   int8 args[9];
+
+   args[0]=port;
+   args[1]=make8(id,0);
+   args[2]=make8(id,1);
+   args[3]=make8(id,2);
+   args[4]=make8(id,3);
+   args[5]=len;
+   args[6]=priority;
+   args[7]=ext;
+   args[8]=rtr;
+   can_dlog_write(DLOG_PUTD, args, 9);
+
+   if ((len)&&(!rtr))
+      can_dlog_data(data, len);
+}
+
+////////////////////////////////////////////////////////////////////////
+//
+// can_dlog_getd()
+//
+// Logs a frame read by can_getd()
+//
+////////////////////////////////////////////////////////////////////////
+void can_dlog_getd(int32 id, int8 *data, int8 len, struct rx_stat &stat) {
+   int8 args[11];
+
+   args[0]=stat.buffer;
+   args[1]=make8(id,0);
+   args[2]=make8(id,1);
+   args[3]=make8(id,2);
+   args[4]=make8(id,3);
+   args[5]=len;
+   args[6]=stat.err_ovfl;
+   args[7]=stat.filthit;
+   args[8]=stat.rtr;
+   args[9]=stat.ext;
+   args[10]=stat.inv;
+   can_dlog_write(DLOG_GETD, args, 11);
+
+   if ((len)&&(!stat.rtr))
+      can_dlog_data(data, len);
+}
+
+////////////////////////////////////////////////////////////////////////
+//
+// isr_can_dlog_tbe()
+//
+// UART transmit buffer empty interrupt, sends the next logged byte and
+// disables itself once the ring buffer is empty
+//
+////////////////////////////////////////////////////////////////////////
+#int_tbe
+void isr_can_dlog_tbe(void) {
+   if (can_dlog_tail == can_dlog_head) {
+      disable_interrupts(INT_TBE);
+      return;
+   }
+
+   putc(can_dlog_buffer[can_dlog_tail]);
+   can_dlog_tail=(can_dlog_tail+1) & CAN_DLOG_MASK;
+}
@@ -0,0 +1,35 @@
+#ifndef CAN_DLOG_H
+#define CAN_DLOG_H
+
+// Deferred binary logging for the CAN driver debug mode (CAN_DO_DEBUG)
+// Instead of formatting text on the PIC, each log call stores a format ID and
+// its raw arguments in a ring buffer that is drained to the UART by the
+// transmit interrupt. tools/dlog_decode.c expands the records on the host
+// using the same table, so the strings never need to be stored on the PIC.
+//
+// Record layout on the UART:
+//   DLOG_SYNC, format ID, arguments
+// The arguments are encoded according to the signature of the format:
+//   B - 8-bit value
+//   L - 32-bit value, little endian
+//   D - data block, a length byte followed by that many bytes
+// Format conversions: %u and %X take a B argument, %lu and %lX take an L
+// argument, %s takes a D argument and prints it as hex bytes
+
+#define DLOG_SYNC 0xA5
+
+// NOTE: The following table is an x-macro
+//        Format name     , Signature , Format string
+#define DLOG_FORMAT_TABLE(ENTRY)                                                                        \
+    ENTRY(DLOG_PUTD_FAIL  , ""        , "CAN_PUTD() FAIL: NO OPEN TX BUFFERS")                           \
+    ENTRY(DLOG_PUTD       , "BLBBBB"  , "CAN_PUTD(): BUFF=%u ID=%lX LEN=%u PRI=%u EXT=%u RTR=%u")         \
+    ENTRY(DLOG_GETD_EMPTY , ""        , "FAIL ON CAN_GETD(): NO MESSAGE IN BUFFER")                      \
+    ENTRY(DLOG_GETD       , "BLBBBBBB", "CAN_GETD(): BUFF=%u ID=%lX LEN=%u OVF=%u FILT=%u RTR=%u EXT=%u INV=%u") \
+    ENTRY(DLOG_DATA       , "D"       , "    DATA = %s")                                                 \
+    ENTRY(DLOG_DROPPED    , "B"       , "DLOG: %u RECORDS DROPPED")
+
+#define EXPAND_AS_DLOG_ENUM(a,b,c) a,
+
+enum {DLOG_FORMAT_TABLE(EXPAND_AS_DLOG_ENUM) N_DLOG_FORMATS};
+
+#endif
@@ -18,12 +18,190 @@
     ENTRY(CAN_BPS_TEMPERATURE1   , 0x608,  8) \
     ENTRY(CAN_BPS_TEMPERATURE2   , 0x609,  8) \
     ENTRY(CAN_BPS_TEMPERATURE3   , 0x60A,  8) \
-    ENTRY(CAN_PMS_DATA           , 0x60E,  8)
-#define N_CAN_ID 4
+    ENTRY(CAN_PMS_DATA           , 0x60E,  8) \
+    ENTRY(CAN_PMS_FAULT          , 0x60F,  8)
+#define N_CAN_ID 5
 
 enum {CAN_ID_TABLE(EXPAND_AS_CAN_ID_ENUM)};
 enum {CAN_ID_TABLE(EXPAND_AS_CAN_LEN_ENUM)};
 
+#define EXPAND_AS_SIGNAL_ENUM(a,b,c) a = b,
+
+// CAN_PMS_DATA is multiplexed, byte 0 of every frame is the mux, the sub-page
+// in the low nibble and PMS_DATA_VERSION in the high nibble. Signals are
+// integers in the unit given, U16 and S16 take two bytes, little endian.
+// The version changes whenever a signal moves, new signals go in free bytes
+// or new sub-pages so neither needs a new CAN ID.
+#define PMS_DATA_VERSION          2
+#define PMS_DATA_MUX              0 // Byte holding the mux
+#define N_PMS_DATA_PAGES          4
+
+#define EXPAND_AS_DATA_NAME(a,b,c,d,e,f)  #a,
+#define EXPAND_AS_DATA_MUX(a,b,c,d,e,f)   b,
+#define EXPAND_AS_DATA_BYTE(a,b,c,d,e,f)  c,
+#define EXPAND_AS_DATA_TYPE(a,b,c,d,e,f)  PMS_TYPE_##d,
+#define EXPAND_AS_DATA_UNIT(a,b,c,d,e,f)  e,
+
+#define PMS_TYPE_U8               0
+#define PMS_TYPE_U16              1
+#define PMS_TYPE_S16              2
+
+// X macro table of signals in the CAN_PMS_DATA packet
+// Sub-page 0 is sent every sending period and one of the others in turn with
+// it. The last column is the value the PMS sends, it is only expanded by the
+// firmware.
+//        Signal name          , Mux, Byte, Type, Unit     , Value
+#define CAN_PMS_DATA_TABLE(ENTRY)                                                                    \
+    ENTRY(PMS_DATA_STATE       ,   0,    1, U8  , "bits"   , pms_state_bits())                       \
+    ENTRY(PMS_DATA_DCDC_TEMP   ,   0,    2, S16 , "0.1degC", g_dcdc_temp)                            \
+    ENTRY(PMS_DATA_UPTIME      ,   0,    4, U16 , "s"      , pms_uptime_s())                         \
+    ENTRY(PMS_DATA_AUX_UV      ,   0,    6, U8  , "enum"   , g_aux_uv)                               \
+    ENTRY(PMS_DATA_DCDC_STATUS ,   0,    7, U8  , "enum"   , g_dcdc_status)                          \
+    ENTRY(PMS_DATA_AUX_CELL1   ,   1,    1, U16 , "mV"     , soc_cell(0))                            \
+    ENTRY(PMS_DATA_AUX_CELL2   ,   1,    3, U16 , "mV"     , soc_cell(1))                            \
+    ENTRY(PMS_DATA_AUX_CELL3   ,   1,    5, U16 , "mV"     , soc_cell(2))                            \
+    ENTRY(PMS_DATA_AUX_CELLS   ,   1,    7, U8  , "cells"  , (soc_max_cell() << 4) | soc_min_cell()) \
+    ENTRY(PMS_DATA_AUX_CELL4   ,   2,    1, U16 , "mV"     , soc_cell(3))                            \
+    ENTRY(PMS_DATA_AUX_SOC     ,   2,    3, U16 , "0.01%"  , soc_percent())                          \
+    ENTRY(PMS_DATA_AUX_DELTA   ,   2,    5, U16 , "mV"     , soc_max_mv() - soc_min_mv())            \
+    ENTRY(PMS_DATA_AUX_FLAGS   ,   2,    7, U8  , "bits"   , soc_flags())                            \
+    ENTRY(PMS_DATA_MPPT_DUTY   ,   3,    1, U8  , "%"      , relay_duty(RELAY_MPPT))                 \
+    ENTRY(PMS_DATA_MOTOR_DUTY  ,   3,    2, U8  , "%"      , relay_duty(RELAY_MOTOR))                \
+    ENTRY(PMS_DATA_PRECHARGE   ,   3,    3, U8  , "bool"   , relay_duty(RELAY_PRECHARGE) != 0)       \
+    ENTRY(PMS_DATA_HORN        ,   3,    4, U8  , "bool"   , relay_duty(RELAY_HORN) != 0)            \
+    ENTRY(PMS_DATA_TEMP_STATUS ,   3,    5, U8  , "enum"   , g_temp_status)                          \
+    ENTRY(PMS_DATA_TX_FAILS    ,   3,    6, U8  , "count"  , g_tx_fail_count)
+#define N_PMS_DATA_SIGNALS 19
+
+// PMS_DATA_STATE bits
+#define PMS_DATA_STATE_ARRAY      0x01 // MPPT relay closed
+#define PMS_DATA_STATE_MOTOR      0x02 // Motor relay closed
+#define PMS_DATA_STATE_BRAKE      0x04 // Brake pressed
+#define PMS_DATA_STATE_HEARTBEAT  0x08 // Toggles with every sub-page 0
+
+// PMS_DATA_AUX_CELLS holds the lowest aux cell (0-3) in the low nibble and the
+// highest in the high nibble, PMS_DATA_AUX_FLAGS the SOC_FLAG_xxx bits of
+// pms_soc.h. PMS_DATA_AUX_UV is an aux_uv_t, PMS_DATA_DCDC_STATUS a
+// dcdc_status_t and PMS_DATA_TEMP_STATUS a temp_status_t.
+
+// X macro table of signals in the CAN_PMS_FAULT packet
+// The fault page is sent with CAN_PMS_DATA while any PMS_FAULT_CAUSE_xxx bit is
+// set, every PARAM_FAULT_SENDING_PERIOD_MS, and once more with no cause when
+// the last fault clears. "u16" signals take two bytes, little endian
+//        Signal name           , Byte, Unit
+#define CAN_PMS_FAULT_TABLE(ENTRY)                 \
+    ENTRY(PMS_FAULT_CAUSE       ,    0, "bits")    \
+    ENTRY(PMS_FAULT_TRIP_COUNT  ,    1, "count")   \
+    ENTRY(PMS_FAULT_TRIP_AGE    ,    2, "u16")     \
+    ENTRY(PMS_FAULT_RELAYS      ,    4, "bits")    \
+    ENTRY(PMS_FAULT_TEMP_STATUS ,    5, "enum")    \
+    ENTRY(PMS_FAULT_TEMP_PAGE   ,    6, "page")    \
+    ENTRY(PMS_FAULT_TEMP_MAX    ,    7, "degC")
+#define N_PMS_FAULT_SIGNALS 7
+
+enum {CAN_PMS_FAULT_TABLE(EXPAND_AS_SIGNAL_ENUM)};
+
+// PMS_FAULT_CAUSE bits
+#define PMS_FAULT_CAUSE_BPS_TRIP      0x01 // A BPS trip is latched
+#define PMS_FAULT_CAUSE_TEMPERATURE   0x02 // Array locked out by the temperature supervisor
+#define PMS_FAULT_CAUSE_CRITICAL      0x04 // Motor locked out by a critical temperature
+#define PMS_FAULT_CAUSE_PRECHARGE     0x08 // Motor locked out by a precharge timeout until its switch is turned off
+#define PMS_FAULT_CAUSE_DCDC_DERATE   0x10 // Horn locked out by the DC/DC temperature
+#define PMS_FAULT_CAUSE_DCDC_CRITICAL 0x20 // Motor locked out by a critical DC/DC temperature
+#define PMS_FAULT_CAUSE_AUX_LOW       0x40 // Loads shed by an aux cell undervoltage
+
+// PMS_FAULT_RELAYS bits
+#define PMS_FAULT_RELAY_ARRAY         0x01
+#define PMS_FAULT_RELAY_MOTOR         0x02
+#define PMS_FAULT_RELAY_BRAKE         0x04 // Brake pressed
+
+// Every byte of a CAN_BPS_TEMPERATUREx packet is a cell temperature in degrees C
+
+// ALARM_PMS_BATTERY_TEMPERATURE is sent whenever the thermal verdict changes and
+// every sending period while it is critical
+//   Byte 0: verdict (temp_status_t in pms_temp.h)
+//   Byte 1: page (1-3) behind the verdict
+//   Byte 2: hottest cell (0-7) of that page
+//   Byte 3: its temperature in degrees C
+//   Byte 4: rise of that page within the current rate of rise window
+#define ALARM_PMS_BATTERY_TEMPERATURE_LEN 5
+
+// ALARM_PMS_AUX_UNDERVOLTAGE is sent whenever the aux undervoltage stage changes
+//   Byte 0: stage (aux_uv_t in pms_aux.h)
+//   Byte 1: lowest aux cell (0-3)
+//   Bytes 2-3: its voltage in mV, little endian
+#define ALARM_PMS_AUX_UNDERVOLTAGE_LEN 4
+
+// ALARM_PMS_STARTUP is sent once as soon as CAN bus is up after a reset
+//   Byte 0: cause of the reset, one of the PMS_RESET_xxx codes
+//   Byte 1: PMS_DATA_VERSION
+//   Bytes 2-3: number of boots recorded in the EEPROM log, little endian
+//   Bytes 4-5: time from the start of main to this frame in us, little endian,
+//              0xFFFF for 65ms or more. The bootloader and the power-up timer
+//              come before main and are not included.
+#define ALARM_PMS_STARTUP_LEN 6
+#define PMS_RESET_POWER_UP             0
+#define PMS_RESET_BROWNOUT             1
+#define PMS_RESET_MCLR                 2 // Reset pin
+#define PMS_RESET_WATCHDOG             3
+#define PMS_RESET_INSTRUCTION          4 // Reset instruction, eg leaving the bootloader
+#define PMS_RESET_OTHER                5 // Stack overflow or underflow
+
+// RESPONSE_PMS_DISCONNECT_ARRAY
+//   Byte 0: number of BPS trips since reset, including this one
+// COMMAND_PMS_RESET_TRIP clears a latched BPS trip
+//   Bytes 0-1: PMS_TRIP_RESET_KEY, little endian
+//   Byte 2: trip count from the RESPONSE_PMS_DISCONNECT_ARRAY being acknowledged
+// RESPONSE_PMS_RESET_TRIP
+//   Byte 0: result, one of the PMS_TRIP_RESET_xxx codes
+//   Byte 1: number of BPS trips since reset
+#define PMS_TRIP_RESET_KEY        0xB5E7
+#define PMS_TRIP_RESET_OK              0 // Trip cleared, the array may reconnect
+#define PMS_TRIP_RESET_BAD_KEY         1 // Wrong key or trip count, trip still latched
+#define PMS_TRIP_RESET_NOT_SAFE        2 // Battery temperatures not all fresh and safe, trip still latched
+#define PMS_TRIP_RESET_NOT_TRIPPED     3 // No trip to clear
+
+// COMMAND_PMS_PARAM and RESPONSE_PMS_PARAM, see pms_param.h for the layout
+#define PMS_PARAM_KEY             0x9A7C
+#define PMS_PARAM_OP_READ              0 // Read one parameter
+#define PMS_PARAM_OP_WRITE             1 // Set one parameter and save the table
+#define PMS_PARAM_OP_DEFAULTS          2 // Restore every default and save the table
+#define PMS_PARAM_OK                   0
+#define PMS_PARAM_BAD_INDEX            1 // No parameter with that index
+#define PMS_PARAM_OUT_OF_RANGE         2 // Value outside the parameter range, or warning not below critical
+#define PMS_PARAM_BAD_KEY              3 // Missing or wrong key, nothing changed
+#define PMS_PARAM_BAD_OP               4 // Unknown operation
+
+// COMMAND_PMS_TRANSFER and RESPONSE_PMS_TRANSFER carry segmented transfers,
+// see pms_isotp.h for the framing. Byte 0 of a request is the service, byte 0
+// of its response the service + PMS_TRANSFER_REPLY, multi-byte fields are
+// little endian.
+//   PMS_TRANSFER_READ_EEPROM   request: address, length (16-bit each)
+//                              response: address, then the EEPROM bytes
+//   PMS_TRANSFER_READ_TRACE    response: entry count, total events logged
+//                              (16-bit), current tick in ms (32-bit), then
+//                              the entries oldest first, see pms_trace.h
+//   PMS_TRANSFER_READ_PARAMS   response: parameter count, then value, minimum
+//                              and maximum of each parameter (16-bit each)
+//   PMS_TRANSFER_WRITE_PARAMS  request: PMS_PARAM_KEY, first index, then the
+//                              new values (16-bit each)
+//                              response: PMS_PARAM_xxx result, number of
+//                              parameters written
+// The parameters are written in index order and the write stops at the first
+// value refused. A request that fails gets PMS_TRANSFER_ERROR, the service
+// and one of the PMS_TRANSFER_BAD_xxx codes.
+#define PMS_TRANSFER_READ_EEPROM    0x01
+#define PMS_TRANSFER_READ_TRACE     0x02
+#define PMS_TRANSFER_READ_PARAMS    0x03
+#define PMS_TRANSFER_WRITE_PARAMS   0x04
+#define PMS_TRANSFER_REPLY          0x40
+#define PMS_TRANSFER_ERROR          0x7F
+#define PMS_TRANSFER_BAD_SERVICE       1 // Unknown service
+#define PMS_TRANSFER_BAD_LENGTH        2 // Request too short or the wrong length
+#define PMS_TRANSFER_BAD_RANGE         3 // Address or length outside the EEPROM
+#define PMS_TRANSFER_BAD_KEY           4 // Missing or wrong key, nothing changed
+
+// COMMAND_PMS_BOOT and RESPONSE_PMS_BOOT, see pms_boot.h
 
 //////////////////////////////
 // CAN COMMAND DEFINES ///////
@@ -37,8 +215,23 @@ enum {CAN_ID_TABLE(EXPAND_AS_CAN_LEN_ENUM)};
     ENTRY(COMMAND_PMS_DISCONNECT_ARRAY  , 0x777) \
     ENTRY(RESPONSE_PMS_DISCONNECT_ARRAY , 0x778) \
     ENTRY(COMMAND_PMS_ENABLE_HORN       , 0x780) \
+    ENTRY(COMMAND_PMS_TRACE_DUMP        , 0x781) \
+    ENTRY(RESPONSE_PMS_TRACE_DUMP       , 0x782) \
+    ENTRY(ALARM_PMS_BATTERY_TEMPERATURE , 0x783) \
+    ENTRY(COMMAND_PMS_RESET_TRIP        , 0x784) \
+    ENTRY(RESPONSE_PMS_RESET_TRIP       , 0x785) \
+    ENTRY(COMMAND_PMS_LOG_DUMP          , 0x786) \
+    ENTRY(RESPONSE_PMS_LOG_DUMP         , 0x787) \
+    ENTRY(COMMAND_PMS_PARAM             , 0x788) \
+    ENTRY(RESPONSE_PMS_PARAM            , 0x789) \
+    ENTRY(ALARM_PMS_AUX_UNDERVOLTAGE    , 0x78A) \
+    ENTRY(COMMAND_PMS_TRANSFER          , 0x78B) \
+    ENTRY(RESPONSE_PMS_TRANSFER         , 0x78C) \
+    ENTRY(COMMAND_PMS_BOOT              , 0x78D) \
+    ENTRY(RESPONSE_PMS_BOOT             , 0x78E) \
+    ENTRY(ALARM_PMS_STARTUP             , 0x78F) \
     ENTRY(COMMAND_PMS_BRAKE_LIGHT       , 0x304)
-#define N_CAN_COMMAND 4
+#define N_CAN_COMMAND 19
 
 enum {CAN_MISC_TABLE(EXPAND_AS_MISC_ID_ENUM)};
 
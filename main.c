@@ -9,99 +9,303 @@
 #include "main.h"
 #include "can_telem.h"
 #include "can18F4580_mscp.c"
+#include "pms_tick.h"
+#include "pms_trace.c"
+#include "pms_log.c"
+#include "pms_param.c"
+#include "pms_temp.c"
+#include "pms_relay.c"
+#include "pms_aux.c"
+#include "pms_soc.c"
+#include "pms_dcdc.c"
+#include "pms_isotp.c"
 
-// Timing periods
-#define SENDING_PERIOD_MS     1000 // Telemetry data is sent over CAN bus at this period
-#define PRECHARGE_DURATION_MS 2000 // CANNOT PRECHARGE FOR MORE THAN 7 SECONDS
-#define HORN_DURATION_MS       500 // Duration of the horn honk
-#define DEBOUNCE_PERIOD_MS      10 // Hardware switch debounce period
+// Timing periods and temperature thresholds are runtime parameters, see pms_param.h
 
-// BMS temperature limits
-#define BPS_TEMP_WARNING        58 // 60C charge limit, PMS should disconnect the array before the warning threshold is reached
-#define BPS_TEMP_CRITICAL       70 // 70C discharge limit
-
-// Miscellaneous defines
-#define N_AUX_CELLS 4
+// Precharge
+#define PRECHARGE_SENSE_MIN        8 // Smallest initial sense reading the closed loop precharge can scale from
+#define PRECHARGE_CONFIRM          3 // Consecutive readings at the target before the motor relay closes
 
 // CAN bus defines
 #define TX_PRI 3
 #define TX_EXT 0
 #define TX_RTR 0
 
-#define ARRAY_ON                \
-    gb_array_connected = true;  \
-    output_high(MPPT_PIN);
+// Telemetry frames still to send in the sending period, one goes out per pass
+// through the idle state, most important first
+#define SEND_ALARM         0x01 // Repeat of the battery temperature alarm while the pack is critical
+#define SEND_FAULT         0x02 // CAN_PMS_FAULT
+#define SEND_DATA          0x04 // CAN_PMS_DATA sub-page 0
+#define SEND_DATA_PAGE     0x08 // CAN_PMS_DATA, the next of the other sub-pages
+
+// CAN_PMS_DATA encoder, one step per signal of CAN_PMS_DATA_TABLE
+#define PMS_PUT_U8(byte,value) \
+    g_pms_data_page[byte] = (value);
+
+#define PMS_PUT_U16(byte,value)             \
+    w = (value);                            \
+    g_pms_data_page[byte]     = make8(w,0); \
+    g_pms_data_page[byte + 1] = make8(w,1);
+
+#define PMS_PUT_S16(byte,value) \
+    PMS_PUT_U16(byte,value)
+
+#define EXPAND_AS_DATA_ENCODE(a,b,c,d,e,f) \
+    if (page == b)                         \
+    {                                      \
+        PMS_PUT_##d(c,f)                   \
+    }
+
+#define ARRAY_ON                 \
+    gb_array_connected = true;   \
+    relay_close(RELAY_MPPT);     \
+    log_count(LOG_ARRAY_CYCLES); \
+    trace_log(TRACE_ARRAY_ON,0);
 
 #define ARRAY_OFF               \
     gb_array_connected = false; \
-    output_low(MPPT_PIN);
+    relay_open(RELAY_MPPT);     \
+    trace_log(TRACE_ARRAY_OFF,0);
 
-#define MOTOR_ON                \
-    gb_motor_connected = true;  \
-    output_high(MOTOR_PIN);
+#define MOTOR_ON                 \
+    gb_motor_connected = true;   \
+    relay_close(RELAY_MOTOR);    \
+    log_count(LOG_MOTOR_CYCLES); \
+    trace_log(TRACE_MOTOR_ON,0);
 
 #define MOTOR_OFF               \
     gb_motor_connected = false; \
-    output_low(MOTOR_PIN);
+    relay_open(RELAY_MOTOR);    \
+    trace_log(TRACE_MOTOR_OFF,0);
 
 // Debounces a hardware pin
-#define DEBOUNCE                               \
-    int16 i;                                   \
-    for (i = 0 ; i < DEBOUNCE_PERIOD_MS ; i++) \
-    {                                          \
-        delay_ms(1);                           \
-    }
-
-static int1        gb_send;
-static int32       g_can0_id;
-static int8        g_can0_data[8];
-static int8        g_can0_len;
-static int1        gb_can0_hit = false;
-static int32       g_can1_id;
-static int8        g_can1_data[8];
-static int8        g_can1_len;
-static int1        gb_can1_hit = false;
-static int32       g_rx_id;
-static int8        g_rx_len;
-static int8        g_rx_data[8];
-static pms_state_t g_state;
-static int1        gb_motor_connected;
-static int1        gb_array_connected;
-static int1        gb_brake_pressed;
-static int1        gb_battery_temperature_safe;
-static int8        g_aux_pack_voltage[N_AUX_CELLS];
-static int8        g_pms_data_page[CAN_PMS_DATA_LEN];
+#define DEBOUNCE                                                \
+    int16 i;                                                    \
+    for (i = 0 ; i < param_get(PARAM_DEBOUNCE_PERIOD_MS) ; i++) \
+    {                                                           \
+        delay_ms(1);                                            \
+    }
+
+static int1          gb_send;
+static int8          g_send_frames;        // SEND_xxx frames left in the sending period
+static int1          gb_aux_sample;
+static int32         g_can0_id;
+static int8          g_can0_data[8];
+static int8          g_can0_len;
+static int1          gb_can0_hit = false;
+static int32         g_can1_id;
+static int8          g_can1_data[8];
+static int8          g_can1_len;
+static int1          gb_can1_hit = false;
+static int32         g_rx_id;
+static int8          g_rx_len;
+static int8          g_rx_data[8];
+static pms_state_t   g_state;
+static int1          gb_motor_connected;
+static int1          gb_array_connected;
+static int1          gb_brake_pressed;
+static int1          gb_battery_temperature_safe;
+static int1          gb_battery_temperature_critical;
+static int1          gb_bps_tripped;
+static int1          gb_precharge_fault;
+static int1          gb_precharging;       // precharge is running, commands are handled from its loop
+static dcdc_status_t g_dcdc_status;
+static signed int16  g_dcdc_temp;
+static aux_uv_t      g_aux_uv;
+static int8          g_tx_fail_count;
+static int8          g_bps_trip_count;
+static int32         g_bps_trip_ms;
+static int1          gb_fault_active;
+static temp_status_t g_temp_status;
+static int16         g_aux_pack_voltage[N_AUX_CELLS];
+static int16         g_aux_cell_mv[N_AUX_CELLS];
+static int8          g_pms_data_page[CAN_PMS_DATA_LEN];
+static int8          g_pms_fault_page[CAN_PMS_FAULT_LEN];
+static int8          g_transfer_service;   // Service of the response being sent
+static int8          g_transfer_head[8];   // Response bytes before the body
+static int8          g_transfer_head_len;
+static int16         g_transfer_addr;      // First EEPROM address of a PMS_TRANSFER_READ_EEPROM
 
 void pms_init(void)
 {
-    gb_motor_connected          = false;
-    gb_array_connected          = false;
-    gb_brake_pressed            = false;
-    gb_battery_temperature_safe = true;
+    gb_motor_connected              = false;
+    gb_array_connected              = false;
+    gb_brake_pressed                = false;
+    gb_battery_temperature_safe     = false; // Until every BPS temperature page has been received
+    gb_battery_temperature_critical = false;
+    gb_bps_tripped                  = false;
+    gb_precharge_fault              = false;
+    gb_precharging                  = false;
+    g_bps_trip_count                = 0;
+    gb_fault_active                 = false;
+    g_send_frames                   = 0;
+    g_temp_status                   = TEMP_STALE;
+    g_dcdc_status                   = DCDC_NORMAL;
+    g_dcdc_temp                     = 0;
+    g_aux_uv                        = AUX_UV_NONE;
+    g_tx_fail_count                 = 0;
     
     // Set up the ADC channels
     setup_adc(ADC_CLOCK_INTERNAL);
     setup_adc_ports(AUX1_ANALOG_PIN | AUX2_ANALOG_PIN | AUX3_ANALOG_PIN | AUX4_ANALOG_PIN |
-                    DCDC_TEMP_ANALOG_PIN);
+                    DCDC_TEMP_ANALOG_PIN | PRECHARGE_SENSE_ANALOG_PIN);
+    
+    relay_init();
+    log_init();
+    param_init();
+    aux_init();
+    soc_init();
+    dcdc_init();
+    isotp_init();
+    temp_init();
+    trace_log(TRACE_BOOT,log_counter(LOG_BOOTS));
 }
 
-// Accepts a packet of BPS temperature data and the length of the packet
-// Checks if each point of data is below the temperature warning threshold
-int1 check_bps_temperature(int * data, int length)
+// Sends a packet with the PMS transmit settings
+// Packets that cannot be queued are recorded in the event trace
+void pms_putd(int32 id, int8 * data, int8 len)
 {
-    int i;
+    if (can_putd(id,data,len,TX_PRI,TX_EXT,TX_RTR) == 0xFF)
+    {
+        trace_log(TRACE_TX_FAIL,(int16)id);
+        if (g_tx_fail_count < 0xFF)
+        {
+            g_tx_fail_count++;
+        }
+    }
+}
+
+// Returns the PMS_RESET_xxx cause of the last reset
+// Only valid before anything else changes RCON, so main calls it first
+int8 reset_cause(void)
+{
+    switch(restart_cause())
+    {
+        case NORMAL_POWER_UP:
+            return PMS_RESET_POWER_UP;
+        case BROWNOUT_RESTART:
+            return PMS_RESET_BROWNOUT;
+        case MCLR_FROM_RUN:
+        case MCLR_FROM_SLEEP:
+            return PMS_RESET_MCLR;
+        case WDT_TIMEOUT:
+        case WDT_FROM_SLEEP:
+            return PMS_RESET_WATCHDOG;
+        case RESET_INSTRUCTION:
+            return PMS_RESET_INSTRUCTION;
+        default:
+            return PMS_RESET_OTHER;
+    }
+}
+
+// Sends ALARM_PMS_STARTUP, the first frame after a reset
+void send_startup(int8 reset)
+{
+    int8  frame[ALARM_PMS_STARTUP_LEN];
+    int16 us;
     
-    for (i = 0 ; i < length ; i++)
+    us = startup_us();
+    frame[0] = reset;
+    frame[1] = PMS_DATA_VERSION;
+    frame[2] = make8(log_counter(LOG_BOOTS),0);
+    frame[3] = make8(log_counter(LOG_BOOTS),1);
+    frame[4] = make8(us,0);
+    frame[5] = make8(us,1);
+    pms_putd(ALARM_PMS_STARTUP_ID,frame,ALARM_PMS_STARTUP_LEN);
+}
+
+// Broadcasts the current thermal verdict on ALARM_PMS_BATTERY_TEMPERATURE
+void send_temperature_alarm(void)
+{
+    int8 alarm[ALARM_PMS_BATTERY_TEMPERATURE_LEN];
+    
+    alarm[0] = g_temp_status;
+    alarm[1] = temp_fault_page();
+    alarm[2] = temp_fault_cell();
+    alarm[3] = temp_fault_max();
+    alarm[4] = temp_fault_rise();
+    pms_putd(ALARM_PMS_BATTERY_TEMPERATURE_ID,alarm,ALARM_PMS_BATTERY_TEMPERATURE_LEN);
+}
+
+// Applies the temperature supervisor verdict to the array and motor
+// Called for every BPS temperature packet and once per sending period, so a
+// BPS that stops transmitting is noticed
+//   Rising, stale or warning: disconnect the array
+//   Critical: also disconnect the motor and keep it off until the pack cools
+void supervise_battery_temperature(void)
+{
+    temp_status_t status;
+    trace_event_t event;
+    int16         arg;
+    
+    status = temp_check(tick_ms());
+    if (status != g_temp_status)
     {
-        if (data[i] >= BPS_TEMP_WARNING)
+        // The verdict changed, record why and tell the rest of the car
+        event = N_TRACE_EVENTS;
+        switch(status)
         {
-            // Temperature is above the warning threshold, return false
-            return 0;
+            case TEMP_RISING:
+                event = TRACE_TEMP_RISING;
+                arg   = make16(temp_fault_rise(),temp_fault_page());
+                break;
+            case TEMP_STALE:
+                event = TRACE_TEMP_STALE;
+                arg   = temp_fault_page();
+                break;
+            case TEMP_HOT:
+                event = TRACE_TEMP_VIOLATION;
+                arg   = make16(temp_fault_cell(),temp_fault_page());
+                break;
+            case TEMP_CRITICAL:
+                event = TRACE_TEMP_CRITICAL;
+                arg   = make16(temp_fault_cell(),temp_fault_page());
+                break;
+            default:
+                break;
+        }
+        if (event != N_TRACE_EVENTS)
+        {
+            // Faults are also kept in the EEPROM log
+            trace_log(event,arg);
+            log_fault(event,arg);
         }
+        g_temp_status = status;
+        send_temperature_alarm();
+    }
+    
+    gb_battery_temperature_critical = (status == TEMP_CRITICAL);
+    if ((gb_battery_temperature_critical == true) && (gb_motor_connected == true))
+    {
+        MOTOR_OFF;
     }
     
-    // The temperatures are below the warning threshold, return true
-    return 1;
+    switch(status)
+    {
+        case TEMP_RISING:
+        case TEMP_STALE:
+        case TEMP_HOT:
+        case TEMP_CRITICAL:
+            // Turn off the array
+            gb_battery_temperature_safe = false;
+            if (gb_array_connected == true)
+            {
+                ARRAY_OFF;
+            }
+            break;
+        case TEMP_SAFE:
+            // Every page is fresh and below the hysteresis band
+            // Turn on the array if it is off, the switch is pressed and there is no BPS trip
+            gb_battery_temperature_safe = true;
+            if ((gb_array_connected == false) && (input_state(MPPT_SWITCH) == 1) && (gb_bps_tripped == false))
+            {
+                ARRAY_ON;
+            }
+            break;
+        default:
+            // TEMP_HOLD, keep the current decision until the pack cools further
+            break;
+    }
 }
 
 void read_aux_voltages(void)
@@ -134,53 +338,361 @@ void read_aux_voltages(void)
     output_low(AUX_READ_PIN);
 }
 
-int8 read_dcdc_temp(void)
+// Reads the DC/DC temperature into g_dcdc_temp and logs it in whole degrees C
+// clamped to 0-255
+void read_dcdc_temp(void)
 {
     int8 temp;
     set_adc_channel(DCDC_TEMP_ADC_CHANNEL);
-    temp = read_adc();
+    g_dcdc_temp = dcdc_convert(read_adc());
     delay_us(10);
-    return temp;
+    
+    temp = 0;
+    if (g_dcdc_temp >= 2550)
+    {
+        temp = 255;
+    }
+    else if (g_dcdc_temp > 0)
+    {
+        temp = g_dcdc_temp / 10;
+    }
+    log_dcdc_temp(temp);
 }
 
-void update_pms_data(void)
+// Applies the DC/DC protection stage for the last reading
+void supervise_dcdc_temperature(void)
+{
+    dcdc_status_t status;
+    trace_event_t event;
+    
+    status = dcdc_update(g_dcdc_temp);
+    if (status != g_dcdc_status)
+    {
+        event = TRACE_DCDC_NORMAL;
+        if (status == DCDC_DERATE)
+        {
+            event = TRACE_DCDC_DERATE;
+        }
+        else if (status == DCDC_CRITICAL)
+        {
+            event = TRACE_DCDC_CRITICAL;
+        }
+        trace_log(event,g_dcdc_temp);
+        if (status > g_dcdc_status)
+        {
+            log_fault(event,g_dcdc_temp);
+        }
+        g_dcdc_status = status;
+    }
+    
+    if ((g_dcdc_status == DCDC_CRITICAL) && (gb_motor_connected == true))
+    {
+        MOTOR_OFF;
+    }
+}
+
+// Returns the PMS_DATA_STATE bits, the heartbeat toggles on every call
+int8 pms_state_bits(void)
 {
     // PMS CAN bus heartbeat signal
     static int1 b_can_heartbeat = 0;
+    int8 bits;
     
-    read_aux_voltages(); // Read the aux voltages
-    g_pms_data_page[0] = g_aux_pack_voltage[0]; // Aux cell 1 voltage
-    g_pms_data_page[1] = g_aux_pack_voltage[1]; // Aux cell 2 voltage
-    g_pms_data_page[2] = g_aux_pack_voltage[2]; // Aux cell 3 voltage
-    g_pms_data_page[3] = g_aux_pack_voltage[3]; // Aux cell 4 voltage
-    g_pms_data_page[4] = read_dcdc_temp();      // DC/DC converter temperature
-    g_pms_data_page[5] = gb_array_connected;    // Motor state
-    g_pms_data_page[6] = gb_motor_connected;    // Array state
-    g_pms_data_page[7] = b_can_heartbeat;       // CAN bus heartbeat
-    
+    bits = 0;
+    if (gb_array_connected == true)
+    {
+        bits |= PMS_DATA_STATE_ARRAY;
+    }
+    if (gb_motor_connected == true)
+    {
+        bits |= PMS_DATA_STATE_MOTOR;
+    }
+    if (gb_brake_pressed == true)
+    {
+        bits |= PMS_DATA_STATE_BRAKE;
+    }
+    if (b_can_heartbeat == true)
+    {
+        bits |= PMS_DATA_STATE_HEARTBEAT;
+    }
     b_can_heartbeat = !b_can_heartbeat;
+    return bits;
+}
+
+// Returns the seconds since boot, saturating at 0xFFFF
+int16 pms_uptime_s(void)
+{
+    int32 s;
+    
+    s = tick_ms() / 1000;
+    if (s > 0xFFFF)
+    {
+        s = 0xFFFF;
+    }
+    return s;
+}
+
+// Fills a sub-page of CAN_PMS_DATA, the encoder is generated from
+// CAN_PMS_DATA_TABLE in can_telem.h so it always matches the decoder
+void update_pms_data(int8 page)
+{
+    int8  i;
+    int16 w;
+    
+    for (i = 0 ; i < CAN_PMS_DATA_LEN ; i++)
+    {
+        g_pms_data_page[i] = 0;
+    }
+    g_pms_data_page[PMS_DATA_MUX] = (PMS_DATA_VERSION << 4) | page;
+    CAN_PMS_DATA_TABLE(EXPAND_AS_DATA_ENCODE)
+}
+
+// Sheds load by the aux undervoltage stage of the last sample
+void supervise_aux_voltage(void)
+{
+    aux_uv_t uv;
+    int8     alarm[ALARM_PMS_AUX_UNDERVOLTAGE_LEN];
+    int16    arg;
+    
+    uv = aux_check_uv(g_aux_cell_mv);
+    if (uv == g_aux_uv)
+    {
+        return;
+    }
+    
+    // The stage changed, record why and tell the rest of the car
+    arg = make16(uv,aux_uv_cell());
+    trace_log(TRACE_AUX_UV,arg);
+    if (uv > g_aux_uv)
+    {
+        log_fault(TRACE_AUX_UV,arg);
+    }
+    alarm[0] = uv;
+    alarm[1] = aux_uv_cell();
+    alarm[2] = make8(aux_uv_mv(),0);
+    alarm[3] = make8(aux_uv_mv(),1);
+    pms_putd(ALARM_PMS_AUX_UNDERVOLTAGE_ID,alarm,ALARM_PMS_AUX_UNDERVOLTAGE_LEN);
+    
+    // The horn is locked out from AUX_UV_WARNING by honk, and the telemetry
+    // slowed from AUX_UV_CRITICAL by isr_timer2
+    if (uv >= AUX_UV_SHED)
+    {
+        relay_limit_hold(AUX_UV_HOLD_DUTY);
+    }
+    else
+    {
+        relay_limit_hold(100);
+    }
+    g_aux_uv = uv;
+}
+
+// Reads and converts the aux pack voltages and updates the state of charge
+void sample_aux_pack(void)
+{
+    read_aux_voltages();
+    aux_convert(g_aux_pack_voltage,g_aux_cell_mv);
+    soc_update(g_aux_cell_mv,tick_ms());
+    supervise_aux_voltage();
+    gb_aux_sample = false;
+}
+
+// Fills the fault page, returns true if a fault is active
+int1 update_pms_fault(void)
+{
+    int8  cause;
+    int8  relays;
+    int32 age;
+    
+    cause = 0;
+    if (gb_bps_tripped == true)
+    {
+        cause |= PMS_FAULT_CAUSE_BPS_TRIP;
+    }
+    if (gb_battery_temperature_safe == false)
+    {
+        cause |= PMS_FAULT_CAUSE_TEMPERATURE;
+    }
+    if (gb_battery_temperature_critical == true)
+    {
+        cause |= PMS_FAULT_CAUSE_CRITICAL;
+    }
+    if (gb_precharge_fault == true)
+    {
+        cause |= PMS_FAULT_CAUSE_PRECHARGE;
+    }
+    if (g_dcdc_status == DCDC_DERATE)
+    {
+        cause |= PMS_FAULT_CAUSE_DCDC_DERATE;
+    }
+    if (g_dcdc_status == DCDC_CRITICAL)
+    {
+        cause |= PMS_FAULT_CAUSE_DCDC_DERATE | PMS_FAULT_CAUSE_DCDC_CRITICAL;
+    }
+    if (g_aux_uv != AUX_UV_NONE)
+    {
+        cause |= PMS_FAULT_CAUSE_AUX_LOW;
+    }
+    
+    relays = 0;
+    if (gb_array_connected == true)
+    {
+        relays |= PMS_FAULT_RELAY_ARRAY;
+    }
+    if (gb_motor_connected == true)
+    {
+        relays |= PMS_FAULT_RELAY_MOTOR;
+    }
+    if (gb_brake_pressed == true)
+    {
+        relays |= PMS_FAULT_RELAY_BRAKE;
+    }
+    
+    // Seconds since the latest BPS trip, saturating, 0 if there has been none
+    age = 0;
+    if (g_bps_trip_count > 0)
+    {
+        age = (tick_ms() - g_bps_trip_ms) / 1000;
+        if (age > 0xFFFF)
+        {
+            age = 0xFFFF;
+        }
+    }
+    
+    g_pms_fault_page[PMS_FAULT_CAUSE]       = cause;
+    g_pms_fault_page[PMS_FAULT_TRIP_COUNT]  = g_bps_trip_count;
+    g_pms_fault_page[PMS_FAULT_TRIP_AGE]    = make8(age,0);
+    g_pms_fault_page[PMS_FAULT_TRIP_AGE+1]  = make8(age,1);
+    g_pms_fault_page[PMS_FAULT_RELAYS]      = relays;
+    g_pms_fault_page[PMS_FAULT_TEMP_STATUS] = g_temp_status;
+    g_pms_fault_page[PMS_FAULT_TEMP_PAGE]   = temp_fault_page();
+    g_pms_fault_page[PMS_FAULT_TEMP_MAX]    = temp_fault_max();
+    
+    return (cause != 0);
+}
+
+int8 read_precharge_sense(void)
+{
+    int8 sense;
+    set_adc_channel(PRECHARGE_SENSE_ADC_CHANNEL);
+    delay_us(10);
+    sense = read_adc() >> 4; // Top 8 bits of the 12-bit reading
+    return sense;
+}
+
+int1 precharge_stopped(void); // After the states it runs, below
+
+// Precharges the motor controller bus, returns true when the motor relay may close
+// The voltage across the motor contactor is sampled every 1ms, the precharge
+// is done once it has fallen to (100 - PARAM_PRECHARGE_PERCENT)% of its
+// reading before the precharge started, ie when the bus has reached that
+// percentage of the pack voltage. A reading too small to scale from (bus
+// already charged, or a broken sense) falls back to the timed precharge.
+// Either way the precharge never runs past PRECHARGE_LIMIT_MS.
+// A BPS trip or a critical pack stops the precharge, it then returns false
+// with gb_bps_tripped or gb_battery_temperature_critical set.
+int1 precharge(void)
+{
+    int32 start;
+    int32 ms;
+    int16 target;
+    int8  confirm;
+    int8  sense;
+    
+    sense = read_precharge_sense();
+    
+    // Time the precharge from when the relay actually closes
+    relay_close(RELAY_PRECHARGE);
+    while (relay_pending(RELAY_PRECHARGE) == true)
+    {
+        delay_ms(1);
+    }
+    start = tick_ms();
+    
+    if (sense < PRECHARGE_SENSE_MIN)
+    {
+        do
+        {
+            delay_ms(1);
+            ms = tick_ms() - start;
+            if (precharge_stopped() == true)
+            {
+                return false;
+            }
+        } while (ms < param_get(PARAM_PRECHARGE_DURATION_MS));
+        trace_log(TRACE_PRECHARGE_DONE,(int16)ms | 0x8000);
+        return true;
+    }
+    
+    // The limit is measured on the tick so the time spent sampling counts too
+    target = ((int16)sense * (100 - param_get(PARAM_PRECHARGE_PERCENT))) / 100;
+    confirm = 0;
+    do
+    {
+        delay_ms(1);
+        ms = tick_ms() - start;
+        if (precharge_stopped() == true)
+        {
+            return false;
+        }
+        sense = read_precharge_sense();
+        if (sense <= target)
+        {
+            confirm++;
+            if (confirm >= PRECHARGE_CONFIRM)
+            {
+                trace_log(TRACE_PRECHARGE_DONE,(int16)ms);
+                return true;
+            }
+        }
+        else
+        {
+            confirm = 0;
+        }
+    } while (ms < PRECHARGE_LIMIT_MS);
+    
+    trace_log(TRACE_PRECHARGE_FAIL,sense);
+    return false;
 }
 
 // Honks the horn for a predefined duration
 void honk(void)
 {
     int16 i;
-    output_high(HORN_PIN);
-    for (i = 0 ; i < HORN_DURATION_MS ; i++)
+    if ((g_dcdc_status != DCDC_NORMAL) || (g_aux_uv != AUX_UV_NONE))
+    {
+        // Locked out to reduce the load on the DC/DC converter or the aux pack
+        return;
+    }
+    relay_close(RELAY_HORN);
+    for (i = 0 ; i < param_get(PARAM_HORN_DURATION_MS) ; i++)
     {
         delay_ms(1);
     }
-    output_low(HORN_PIN);
+    relay_open(RELAY_HORN);
 }
 
-// INT_TIMER2 programmed to trigger every 1ms with a 20MHz clock
+// INT_TIMER2 programmed to trigger every 1ms, see pms_clock.h
 // This interrupt will send out telemetry data for the aux pack and the dcdc converter
-// This interrupt will also toggle the status LED
+// This interrupt will also toggle the status LED, which blinks faster during a fault
+// and slower while the aux pack is critically low (a fault keeps its period,
+// see pms_aux.h), carries out the queued relay changes and flags when the aux
+// pack is due to be sampled
+// The periods are read from the parameter table directly, param_set masks
+// this interrupt while it changes them
 #int_timer2
 void isr_timer2(void)
 {
     static int16 ms = 0;
-    if (ms >= SENDING_PERIOD_MS)
+    static int8  sample_ms = 0;
+    g_tick_ms++;
+    relay_tick();
+    if (++sample_ms >= AUX_SAMPLE_PERIOD_MS)
+    {
+        sample_ms = 0;
+        gb_aux_sample = true;
+    }
+    if ((ms >= ((g_aux_uv == AUX_UV_CRITICAL) ? AUX_UV_SENDING_PERIOD_MS : g_param[PARAM_SENDING_PERIOD_MS])) ||
+        ((gb_fault_active == true) && (ms >= g_param[PARAM_FAULT_SENDING_PERIOD_MS])))
     {
         ms = 0;                    // Reset timer
         output_toggle(STATUS_LED); // Toggle the status LED
@@ -222,7 +734,9 @@ void isr_canrx1()
     }
 }
 
-void idle_state(void)
+// Transfers a packet received by the CAN interrupts into g_rx_id/len/data
+// Returns true if a packet was waiting
+int1 receive_packet(void)
 {
     if (gb_can0_hit == true)
     {
@@ -231,7 +745,7 @@ void idle_state(void)
         g_rx_len = g_can0_len;
         memcpy(g_rx_data,g_can0_data,8);
         gb_can0_hit = false;
-        g_state = DATA_RECEIVED;
+        return true;
     }
     else if (gb_can1_hit == true)
     {
@@ -240,16 +754,271 @@ void idle_state(void)
         g_rx_len = g_can1_len;
         memcpy(g_rx_data,g_can1_data,8);
         gb_can1_hit = false;
+        return true;
+    }
+    
+    return false;
+}
+
+// Resets into the bootloader for a firmware update, the command must carry
+// the key and is refused while the motor relay is closed
+void enter_bootloader(void)
+{
+    int8 response[2];
+    
+    response[0] = BOOT_OP_ENTER;
+    if ((g_rx_len == 0) || (g_rx_data[0] != BOOT_OP_ENTER))
+    {
+        // The loader is not running, there is no update to continue
+        response[1] = BOOT_BAD_STATE;
+    }
+    else if ((g_rx_len < 3) || (make16(g_rx_data[2],g_rx_data[1]) != BOOT_KEY))
+    {
+        response[1] = BOOT_BAD_KEY;
+    }
+    else if ((gb_motor_connected == true) || (gb_precharging == true))
+    {
+        response[1] = BOOT_BUSY;
+    }
+    else
+    {
+        response[1] = BOOT_OK;
+    }
+    pms_putd(RESPONSE_PMS_BOOT_ID,response,2);
+    if (response[1] != BOOT_OK)
+    {
+        return;
+    }
+    
+    if (gb_array_connected == true)
+    {
+        ARRAY_OFF;
+    }
+    
+    // Any background EEPROM write is left to finish, the record it belongs
+    // to is lost as it would be by a power loss
+    while (EECON1_WR == 1)
+    {
+    }
+    write_eeprom(BOOT_RECORD + BOOT_RECORD_REQUEST,BOOT_REQUEST_ENTER);
+    while (EECON1_WR == 1)
+    {
+    }
+    delay_ms(5); // Let the response go out
+    reset_cpu();
+}
+
+// Returns the byte at offset of the response being sent, called by pms_isotp.c
+int8 transfer_byte(int16 offset)
+{
+    if (offset < g_transfer_head_len)
+    {
+        return g_transfer_head[offset];
+    }
+    offset -= g_transfer_head_len;
+    
+    switch(g_transfer_service)
+    {
+        case PMS_TRANSFER_READ_EEPROM:
+            return read_eeprom(g_transfer_addr + offset);
+        case PMS_TRANSFER_READ_TRACE:
+            return trace_byte(offset);
+        case PMS_TRANSFER_READ_PARAMS:
+            // Value, minimum and maximum of each parameter
+            switch(offset % 6)
+            {
+                case 0:
+                    return make8(param_get(offset / 6),0);
+                case 1:
+                    return make8(param_get(offset / 6),1);
+                case 2:
+                    return make8(param_min(offset / 6),0);
+                case 3:
+                    return make8(param_min(offset / 6),1);
+                case 4:
+                    return make8(param_max(offset / 6),0);
+                default:
+                    return make8(param_max(offset / 6),1);
+            }
+        default:
+            return 0;
+    }
+}
+
+// Carries out a complete transfer request and starts its response
+void transfer_request(void)
+{
+    int8  service;
+    int8  len;
+    int8  error;
+    int8  result;
+    int8  i;
+    int16 count;
+    
+    service = isotp_request(0);
+    len     = isotp_request_len();
+    error   = 0;
+    count   = 0;
+    g_transfer_service  = service;
+    g_transfer_head[0]  = service | PMS_TRANSFER_REPLY;
+    g_transfer_head_len = 1;
+    
+    switch(service)
+    {
+        case PMS_TRANSFER_READ_EEPROM:
+            if (len < 5)
+            {
+                error = PMS_TRANSFER_BAD_LENGTH;
+                break;
+            }
+            g_transfer_addr = make16(isotp_request(2),isotp_request(1));
+            count = make16(isotp_request(4),isotp_request(3));
+            if ((g_transfer_addr >= LOG_EEPROM_SIZE) || (count > (LOG_EEPROM_SIZE - g_transfer_addr)))
+            {
+                error = PMS_TRANSFER_BAD_RANGE;
+                break;
+            }
+            g_transfer_head[1]  = make8(g_transfer_addr,0);
+            g_transfer_head[2]  = make8(g_transfer_addr,1);
+            g_transfer_head_len = 3;
+            break;
+        case PMS_TRANSFER_READ_TRACE:
+            // Logging stops until the last entry has been sent, see transfer_service
+            trace_hold(true);
+            count = (int16)trace_count() * TRACE_RECORD_LEN;
+            g_transfer_head[1] = trace_count();
+            g_transfer_head[2] = make8(trace_total(),0);
+            g_transfer_head[3] = make8(trace_total(),1);
+            g_transfer_head[4] = make8(tick_ms(),0);
+            g_transfer_head[5] = make8(tick_ms(),1);
+            g_transfer_head[6] = make8(tick_ms(),2);
+            g_transfer_head[7] = make8(tick_ms(),3);
+            g_transfer_head_len = 8;
+            break;
+        case PMS_TRANSFER_READ_PARAMS:
+            count = (int16)N_PARAMS * 6;
+            g_transfer_head[1]  = N_PARAMS;
+            g_transfer_head_len = 2;
+            break;
+        case PMS_TRANSFER_WRITE_PARAMS:
+            if ((len < 4) || (((len - 4) & 1) != 0))
+            {
+                error = PMS_TRANSFER_BAD_LENGTH;
+                break;
+            }
+            if (make16(isotp_request(2),isotp_request(1)) != PMS_PARAM_KEY)
+            {
+                error = PMS_TRANSFER_BAD_KEY;
+                break;
+            }
+            result = PMS_PARAM_OK;
+            for (i = 0 ; (i < ((len - 4) / 2)) && (result == PMS_PARAM_OK) ; i++)
+            {
+                result = param_set(isotp_request(3) + i,
+                                   make16(isotp_request(5 + 2 * i),isotp_request(4 + 2 * i)));
+            }
+            if (result != PMS_PARAM_OK)
+            {
+                i--;
+            }
+            trace_log(TRACE_PARAM,make16(result,isotp_request(3)));
+            aux_calibrate(); // The aux calibration may have changed
+            g_transfer_head[1]  = result;
+            g_transfer_head[2]  = i;
+            g_transfer_head_len = 3;
+            break;
+        default:
+            error = PMS_TRANSFER_BAD_SERVICE;
+            break;
+    }
+    
+    if (error != 0)
+    {
+        g_transfer_service  = 0;
+        g_transfer_head[0]  = PMS_TRANSFER_ERROR;
+        g_transfer_head[1]  = service;
+        g_transfer_head[2]  = error;
+        g_transfer_head_len = 3;
+        count = 0;
+    }
+    isotp_send(g_transfer_head_len + count,tick_ms());
+}
+
+// Takes a frame of a transfer request, answers flow control at once
+void transfer_receive(void)
+{
+    int8 frame[ISOTP_FRAME_LEN];
+    
+    switch(isotp_receive(g_rx_data,g_rx_len,tick_ms()))
+    {
+        case ISOTP_RX_FLOW:
+            pms_putd(RESPONSE_PMS_TRANSFER_ID,frame,isotp_flow_frame(frame));
+            break;
+        case ISOTP_RX_DONE:
+            trace_log(TRACE_RX_COMMAND,COMMAND_PMS_TRANSFER_ID);
+            transfer_request();
+            break;
+        default:
+            break;
+    }
+}
+
+// Sends the next frame of a transfer response when it is due
+// Called between the housekeeping jobs of the idle state, one frame per pass,
+// so a long transfer never holds up the switches or the aux samples
+void transfer_service(void)
+{
+    int8  frame[ISOTP_FRAME_LEN];
+    int32 now;
+    
+    now = tick_ms();
+    
+    // The EEPROM cannot be read during a byte write, an EEPROM frame waits
+    // for a write started by log_service or param_service to finish
+    if (can_tbe() && (isotp_tx_ready(now) == true) &&
+        ((g_transfer_service != PMS_TRANSFER_READ_EEPROM) || (EECON1_WR == 0)))
+    {
+        pms_putd(RESPONSE_PMS_TRANSFER_ID,frame,isotp_tx_frame(frame,now));
+    }
+    if (isotp_tx_pending() == false)
+    {
+        // The response is complete or was abandoned, resume the trace
+        trace_hold(false);
+    }
+}
+
+void idle_state(void)
+{
+    if (receive_packet() == true)
+    {
         g_state = DATA_RECEIVED;
     }
-    else if (can_tbe() && (gb_send == true))
+    else if (can_tbe() && ((gb_send == true) || (g_send_frames != 0)))
     {
         // Ready to send data
         g_state = DATA_SENDING;
     }
+    else if (can_tbe() && (trace_dump_pending() == true))
+    {
+        // Trace dump in progress, send the next frame
+        g_state = TRACE_SENDING;
+    }
+    else if (can_tbe() && (log_dump_pending() == true))
+    {
+        // Log dump in progress, send the next frame
+        g_state = LOG_SENDING;
+    }
     else
     {
-        // Nothing, proceed to check switches
+        // Nothing, send the next frame of a transfer, write the next EEPROM
+        // byte, sample the aux pack when it is due and proceed to check switches
+        transfer_service();
+        log_service();
+        param_service();
+        if (gb_aux_sample == true)
+        {
+            sample_aux_pack();
+        }
         g_state = CHECK_SWITCHES;
     }
 }
@@ -257,12 +1026,13 @@ void idle_state(void)
 void check_switches_state(void)
 {
     // Check the array switch
-    if ((input_state(MPPT_SWITCH) == 1) && (gb_array_connected == false) && (gb_battery_temperature_safe == true))
+    if ((input_state(MPPT_SWITCH) == 1) && (gb_array_connected == false) && (gb_battery_temperature_safe == true) &&
+        (gb_bps_tripped == false))
     {
         DEBOUNCE;
         if (input_state(MPPT_SWITCH) == 1)
         {
-            // If the switch was turned on and the battery temperature is safe, turn on the array
+            // If the switch was turned on, the battery temperature is safe and there is no BPS trip, turn on the array
             ARRAY_ON;
         }
     }
@@ -277,22 +1047,44 @@ void check_switches_state(void)
     }
     
     // Check the motor switch
-    if ((input_state(MOTOR_SWITCH) == 1) && (gb_motor_connected == false))
+    if ((input_state(MOTOR_SWITCH) == 1) && (gb_motor_connected == false) && (gb_battery_temperature_critical == false) &&
+        (gb_bps_tripped == false) && (gb_precharge_fault == false) && (g_dcdc_status != DCDC_CRITICAL))
     {
         DEBOUNCE;
         if (input_state(MOTOR_SWITCH) == 1)
         {
             // If the switch was turned on, precharge the motor and turn it on
-            output_high(PRECHARGE_PIN);
-            for (i = 0 ; i < PRECHARGE_DURATION_MS ; i++)
+            trace_log(TRACE_PRECHARGE,1);
+            log_count(LOG_PRECHARGES);
+            gb_precharging = true;
+            if (precharge() == true)
             {
-                delay_ms(1);
+                // Make before break, the precharge relay opens once the motor relay has closed
+                MOTOR_ON;
+                relay_queue(RELAY_PRECHARGE,0);
             }
-            MOTOR_ON;
-            delay_ms(10);
-            output_low(PRECHARGE_PIN);
+            else if ((gb_bps_tripped == true) || (gb_battery_temperature_critical == true))
+            {
+                // Stopped by a BPS trip or a critical pack, the motor stays
+                // off until that clears
+                relay_open(RELAY_PRECHARGE);
+            }
+            else
+            {
+                // The bus did not charge, keep the motor off until the switch is turned off
+                relay_open(RELAY_PRECHARGE);
+                gb_precharge_fault = true;
+                log_fault(TRACE_PRECHARGE_FAIL,read_precharge_sense());
+            }
+            gb_precharging = false;
+            trace_log(TRACE_PRECHARGE,0);
         }
     }
+    else if ((input_state(MOTOR_SWITCH) == 0) && (gb_precharge_fault == true))
+    {
+        // The driver has acknowledged the precharge fault, allow another attempt
+        gb_precharge_fault = false;
+    }
     else if ((input_state(MOTOR_SWITCH) == 0) && (gb_motor_connected == true))
     {
         DEBOUNCE;
@@ -310,8 +1102,9 @@ void check_switches_state(void)
         if (input_state(BRAKE_SWITCH) == 1)
         {
             // If the brake was pressed, signal the blinker to turn on the brake lights
-            can_putd(COMMAND_PMS_BRAKE_LIGHT_ID,0,0,TX_PRI,TX_EXT,TX_RTR);
+            pms_putd(COMMAND_PMS_BRAKE_LIGHT_ID,0,0);
             gb_brake_pressed = true;
+            trace_log(TRACE_BRAKE,1);
         }
     }
     else if ((input_state(BRAKE_SWITCH) == 0) && (gb_brake_pressed == true))
@@ -320,8 +1113,9 @@ void check_switches_state(void)
         if (input_state(BRAKE_SWITCH) == 0)
         {
             // If the brake was released, signal the blinker to turn off the brake lights
-            can_putd(COMMAND_PMS_BRAKE_LIGHT_ID,0,0,TX_PRI,TX_EXT,TX_RTR);
+            pms_putd(COMMAND_PMS_BRAKE_LIGHT_ID,0,0);
             gb_brake_pressed = false;
+            trace_log(TRACE_BRAKE,0);
         }
     }
     
@@ -329,39 +1123,168 @@ void check_switches_state(void)
     g_state = IDLE;
 }
 
+// Latches a BPS trip
+// The PMS assumes a BPS trip when it receives a CAN command to disconnect the
+// array. The array and motor stay off until the trip is cleared by
+// COMMAND_PMS_RESET_TRIP, everything else keeps running.
+void bps_trip(void)
+{
+    if (g_bps_trip_count < 0xFF)
+    {
+        g_bps_trip_count++;
+    }
+    gb_bps_tripped = true;
+    g_bps_trip_ms  = tick_ms();
+    trace_log(TRACE_BPS_TRIP,g_bps_trip_count);
+    log_count(LOG_BPS_TRIPS);
+    log_fault(TRACE_BPS_TRIP,log_counter(LOG_BPS_TRIPS));
+    
+    if (gb_array_connected == true)
+    {
+        ARRAY_OFF;
+    }
+    pms_putd(RESPONSE_PMS_DISCONNECT_ARRAY_ID,&g_bps_trip_count,1);
+}
+
+// Clears a latched BPS trip if the reset command carries the key and the
+// current trip count, and the battery temperatures are all fresh and safe
+void reset_bps_trip(void)
+{
+    int8 response[2];
+    
+    if (gb_bps_tripped == false)
+    {
+        response[0] = PMS_TRIP_RESET_NOT_TRIPPED;
+    }
+    else if ((g_rx_len < 3) || (make16(g_rx_data[1],g_rx_data[0]) != PMS_TRIP_RESET_KEY) ||
+             (g_rx_data[2] != g_bps_trip_count))
+    {
+        response[0] = PMS_TRIP_RESET_BAD_KEY;
+    }
+    else if (temp_check(tick_ms()) != TEMP_SAFE)
+    {
+        response[0] = PMS_TRIP_RESET_NOT_SAFE;
+    }
+    else
+    {
+        // The array reconnects on the next temperature check if its switch is on
+        gb_bps_tripped = false;
+        response[0] = PMS_TRIP_RESET_OK;
+    }
+    
+    trace_log(TRACE_TRIP_RESET,response[0]);
+    response[1] = g_bps_trip_count;
+    pms_putd(RESPONSE_PMS_RESET_TRIP_ID,response,2);
+}
+
+// Reads or changes a runtime parameter and replies with its value and range
+// Changes need the key and take effect straight away
+void param_command(void)
+{
+    int8 response[8];
+    int8 op;
+    int8 index;
+    
+    op    = (g_rx_len > 0) ? g_rx_data[0] : 0xFF;
+    index = (g_rx_len > 1) ? g_rx_data[1] : 0;
+    
+    if ((op == PMS_PARAM_OP_WRITE) || (op == PMS_PARAM_OP_DEFAULTS))
+    {
+        if ((g_rx_len < 6) || (make16(g_rx_data[5],g_rx_data[4]) != PMS_PARAM_KEY))
+        {
+            response[0] = PMS_PARAM_BAD_KEY;
+        }
+        else if (op == PMS_PARAM_OP_WRITE)
+        {
+            response[0] = param_set(index,make16(g_rx_data[3],g_rx_data[2]));
+        }
+        else
+        {
+            param_defaults();
+            response[0] = PMS_PARAM_OK;
+        }
+        trace_log(TRACE_PARAM,make16(response[0],index));
+        aux_calibrate(); // The aux calibration may have changed
+    }
+    else if (op == PMS_PARAM_OP_READ)
+    {
+        response[0] = PMS_PARAM_OK;
+    }
+    else
+    {
+        response[0] = PMS_PARAM_BAD_OP;
+    }
+    
+    if ((response[0] != PMS_PARAM_BAD_OP) && (index >= N_PARAMS))
+    {
+        response[0] = PMS_PARAM_BAD_INDEX;
+    }
+    response[1] = index;
+    if (index < N_PARAMS)
+    {
+        response[2] = make8(param_get(index),0);
+        response[3] = make8(param_get(index),1);
+        response[4] = make8(param_min(index),0);
+        response[5] = make8(param_min(index),1);
+        response[6] = make8(param_max(index),0);
+        response[7] = make8(param_max(index),1);
+    }
+    else
+    {
+        memset(response + 2,0,6);
+    }
+    pms_putd(RESPONSE_PMS_PARAM_ID,response,8);
+}
+
 void data_received_state(void)
 {
     switch(g_rx_id)
     {
         case COMMAND_PMS_DISCONNECT_ARRAY_ID:
             // Received a command to disconnect the array
-            // Turn off the array and send a response
-            ARRAY_OFF;
-            can_putd(RESPONSE_PMS_DISCONNECT_ARRAY_ID,0,0,TX_PRI,TX_EXT,TX_RTR);
-            g_state = BPS_TRIP;
-            return; // Break out of this state early, fall into the bps trip state
+            // Latch a BPS trip, turn off the array and send a response
+            trace_log(TRACE_RX_COMMAND,COMMAND_PMS_DISCONNECT_ARRAY_ID);
+            bps_trip();
+            break;
+        case COMMAND_PMS_RESET_TRIP_ID:
+            // Received a command to clear a BPS trip
+            trace_log(TRACE_RX_COMMAND,COMMAND_PMS_RESET_TRIP_ID);
+            reset_bps_trip();
             break;
         case COMMAND_PMS_ENABLE_HORN_ID:
             // Received a command to honk the horn
+            trace_log(TRACE_RX_COMMAND,COMMAND_PMS_ENABLE_HORN_ID);
             honk();
             break;
+        case COMMAND_PMS_TRACE_DUMP_ID:
+            // Received a command to dump the event trace
+            trace_log(TRACE_RX_COMMAND,COMMAND_PMS_TRACE_DUMP_ID);
+            trace_dump_start();
+            break;
+        case COMMAND_PMS_LOG_DUMP_ID:
+            // Received a command to dump the EEPROM log
+            trace_log(TRACE_RX_COMMAND,COMMAND_PMS_LOG_DUMP_ID);
+            log_dump_start((g_rx_len > 0) ? g_rx_data[0] : 0);
+            break;
+        case COMMAND_PMS_PARAM_ID:
+            // Received a parameter read or write
+            trace_log(TRACE_RX_COMMAND,COMMAND_PMS_PARAM_ID);
+            param_command();
+            break;
+        case COMMAND_PMS_TRANSFER_ID:
+            // Received a frame of a segmented transfer
+            transfer_receive();
+            break;
+        case COMMAND_PMS_BOOT_ID:
+            // Received a request for a firmware update
+            trace_log(TRACE_RX_COMMAND,COMMAND_PMS_BOOT_ID);
+            enter_bootloader();
+            break;
         case CAN_BPS_TEMPERATURE1_ID:
         case CAN_BPS_TEMPERATURE2_ID:
         case CAN_BPS_TEMPERATURE3_ID:
-            if (check_bps_temperature(g_rx_data,g_rx_len) == 0)
-            {
-                // One of the battery temperatures is above the warning threshold
-                // Turn off the array
-                gb_battery_temperature_safe = false;
-                ARRAY_OFF;
-            }
-            else if ((gb_array_connected == false) && (input_state(MPPT_SWITCH) == 1))
-            {
-                // The battery temperatures are all below the warning threshold
-                // Turn on the array if it is off and the switch is pressed
-                gb_battery_temperature_safe = true;
-                ARRAY_ON;
-            }
+            temp_update(g_rx_id - CAN_BPS_TEMPERATURE1_ID,g_rx_data,g_rx_len,tick_ms());
+            supervise_battery_temperature();
             break;
         default:
             break;
@@ -371,40 +1294,148 @@ void data_received_state(void)
     g_state = IDLE;
 }
 
+// Handles the packets received during the precharge, every 1ms, the single
+// packet buffers would otherwise lose a BPS trip to the next temperature
+// packet. Returns true if the precharge has to stop.
+int1 precharge_stopped(void)
+{
+    while (receive_packet() == true)
+    {
+        data_received_state();
+    }
+    return ((gb_bps_tripped == true) || (gb_battery_temperature_critical == true));
+}
+
 void data_sending_state(void)
 {
-    // Sends a packet of telemetry data
-    update_pms_data();
-    can_putd(CAN_PMS_DATA_ID,g_pms_data_page,CAN_PMS_DATA_LEN,TX_PRI,TX_EXT,TX_RTR);
-    gb_send = false; // Reset sending flag
+    static int8   page = 1;
+    static int32  data_ms = 0;
+    temp_status_t status;
+    int32         now;
+    
+    if (gb_send == true)
+    {
+        // Start of a sending period, supervise and work out the frames to
+        // send. A change of the temperature status sends its alarm straight
+        // away, so the frames wait for the next passes
+        status = g_temp_status;
+        supervise_battery_temperature();
+        read_dcdc_temp();
+        supervise_dcdc_temperature();
+        
+        // Sub-page 0 every period and the others in turn. While the aux
+        // pack is critical the data pages wait for AUX_UV_SENDING_PERIOD_MS,
+        // the periods of an active fault only send the alarm and fault pages
+        g_send_frames = 0;
+        now = tick_ms();
+        if ((g_aux_uv != AUX_UV_CRITICAL) || ((now - data_ms) >= AUX_UV_SENDING_PERIOD_MS))
+        {
+            g_send_frames = SEND_DATA | SEND_DATA_PAGE;
+            data_ms = now;
+        }
+        if ((g_temp_status == TEMP_CRITICAL) && (status == TEMP_CRITICAL))
+        {
+            // Keep repeating the alarm while the pack is critical
+            g_send_frames |= SEND_ALARM;
+        }
+        
+        // The fault page is sent while a fault is active, and once more when
+        // it clears so the dashboard sees the all clear
+        if ((update_pms_fault() == true) || (gb_fault_active == true))
+        {
+            g_send_frames |= SEND_FAULT;
+        }
+        gb_fault_active = (g_pms_fault_page[PMS_FAULT_CAUSE] != 0);
+        gb_send = false; // Reset sending flag
+    }
+    else if ((g_send_frames & SEND_ALARM) != 0)
+    {
+        send_temperature_alarm();
+        g_send_frames &= ~SEND_ALARM;
+    }
+    else if ((g_send_frames & SEND_FAULT) != 0)
+    {
+        pms_putd(CAN_PMS_FAULT_ID,g_pms_fault_page,CAN_PMS_FAULT_LEN);
+        g_send_frames &= ~SEND_FAULT;
+    }
+    else if ((g_send_frames & SEND_DATA) != 0)
+    {
+        update_pms_data(0);
+        pms_putd(CAN_PMS_DATA_ID,g_pms_data_page,CAN_PMS_DATA_LEN);
+        g_send_frames &= ~SEND_DATA;
+    }
+    else
+    {
+        update_pms_data(page);
+        pms_putd(CAN_PMS_DATA_ID,g_pms_data_page,CAN_PMS_DATA_LEN);
+        page = (page >= (N_PMS_DATA_PAGES - 1)) ? 1 : page + 1;
+        g_send_frames &= ~SEND_DATA_PAGE;
+    }
+    
+    // Return to idle state
+    g_state = IDLE;
+}
+
+void trace_sending_state(void)
+{
+    // Sends the next frame of a trace dump
+    int8 frame[TRACE_FRAME_LEN];
+    int8 len;
+    
+    len = trace_dump_frame(frame);
+    pms_putd(RESPONSE_PMS_TRACE_DUMP_ID,frame,len);
     
     // Return to idle state
     g_state = IDLE;
 }
 
-void bps_trip_state(void)
+void log_sending_state(void)
 {
-    // The PMS will assume a bps trip when it receives a CAN command to disconnect the array
-    // The state machine will never exit this state if it falls in, the PMS will need to be reset
-    g_state = BPS_TRIP;
+    // Sends the next frame of a log dump
+    int8 frame[LOG_FRAME_LEN];
+    int8 len;
+    
+    len = log_dump_frame(frame);
+    pms_putd(RESPONSE_PMS_LOG_DUMP_ID,frame,len);
+    
+    // Return to idle state
+    g_state = IDLE;
 }
 
 // Main
 void main()
 {
-    // Enable CAN receive interrupts
+    int8 reset;
+    
+    // Relays off before anything else, then time the rest of the startup
+    relay_safe();
+    reset = reset_cause();
+    startup_timer_start();
+    
+    pms_init();
+    if (can_init() == false)
+    {
+        // A mode change timed out, the bus or the transceiver is stuck. The
+        // PMS keeps running on its switches, frames queue up until the
+        // module reaches normal mode.
+        trace_log(TRACE_CAN_INIT_FAIL,can_get_mode());
+        log_fault(TRACE_CAN_INIT_FAIL,can_get_mode());
+    }
+    
+    // Interrupts only once everything they use is set up
     clear_interrupt(INT_CANRX0);
     enable_interrupts(INT_CANRX0);
     clear_interrupt(INT_CANRX1);
     enable_interrupts(INT_CANRX1);
-    
-    // Setup timer interrupts
-    setup_timer_2(T2_DIV_BY_4,79,16); // Timer 2 set up to interrupt every 1ms with a 20MHz clock
+    setup_timer_2(CLOCK_T2_DIV,CLOCK_T2_PR2,CLOCK_T2_POST); // Timer 2 set up to interrupt every 1ms, see pms_clock.h
     enable_interrupts(INT_TIMER2);
     enable_interrupts(GLOBAL);
     
-    pms_init();
-    can_init();
+    // Tell the car the PMS is up and send the first telemetry straight
+    // away instead of a sending period later, with a first aux pack sample
+    send_startup(reset);
+    sample_aux_pack();
+    gb_send = true;
     
     // Start in idle state
     g_state = IDLE;
@@ -425,8 +1456,11 @@ void main()
             case DATA_SENDING:
                 data_sending_state();
                 break;
-            case BPS_TRIP:
-                bps_trip_state();
+            case TRACE_SENDING:
+                trace_sending_state();
+                break;
+            case LOG_SENDING:
+                log_sending_state();
                 break;
             default:
                 break;
@@ -1,5 +1,8 @@
 #include <18F26K80.h>
-#device adc=8
+#include "pms_boot.h"
+#include "pms_clock.h"
+#device adc=12
+#device WRITE_EEPROM=ASYNC      //write_eeprom returns without waiting, pms_log.c polls EECON1.WR
 
 #FUSES NOWDT                    //No Watch Dog Timer
 #FUSES SOSC_DIG                 //Digital mode, I/O port functionality of RC0 and RC1
@@ -13,7 +16,14 @@
 #FUSES NOPROTECT
 #FUSES CANC                     //Enable to move CAN pins to C6(TX) and C7(RX)
 
-#use delay(clock = 20000000)
+#use delay(clock = CLOCK_XTAL_HZ)
+
+// The CAN bootloader occupies the bottom of program memory, the application
+// is linked above it, see pms_boot.h
+#ifndef _bootloader
+#build(reset=BOOT_APP_START, interrupt=BOOT_APP_START + 0x08)
+#org 0, BOOT_APP_START - 1 {}
+#endif
 
 // SWITCHES
 #define MPPT_SWITCH   PIN_B4
@@ -34,6 +44,7 @@
 #define AUX3_PIN      PIN_A2
 #define AUX4_PIN      PIN_A3
 #define DCDC_TEMP_PIN PIN_B0
+#define PRECHARGE_SENSE_PIN PIN_B1
 
 // Aux pack ADC channels and pins
 #define AUX1_ADC_CHANNEL          0
@@ -49,6 +60,12 @@
 #define DCDC_TEMP_ADC_CHANNEL    10
 #define DCDC_TEMP_ANALOG_PIN  sAN10
 
+// Precharge sense ADC channel and pin
+// Voltage across the motor contactor (pack side minus motor controller bus
+// side) through a divider, it falls towards 0 as the bus precharges
+#define PRECHARGE_SENSE_ADC_CHANNEL    8
+#define PRECHARGE_SENSE_ANALOG_PIN  sAN8
+
 // State machine states
 typedef enum
 {
@@ -56,6 +73,7 @@ typedef enum
     CHECK_SWITCHES,
     DATA_RECEIVED,
     DATA_SENDING,
-    BPS_TRIP,
+    TRACE_SENDING,
+    LOG_SENDING,
     N_STATES
 } pms_state_t;
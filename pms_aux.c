@@ -0,0 +1,127 @@
+// Aux pack cell voltages
+// aux_convert and aux_check_uv take constant time, the scales are computed
+// by aux_calibrate
+
+#include "pms_aux.h"
+
+static int32 g_aux_scale[N_AUX_CELLS]; // Millivolts per count, 16.16 fixed point
+static int16 g_aux_zero[N_AUX_CELLS];  // Reading at 0V
+static int1  gb_aux_differential;
+static int8  g_aux_uv_stage; // Stage, aux_uv_t
+static int8  g_aux_uv_count; // Samples in a row that called for another stage
+static int8  g_aux_uv_cell;  // Lowest cell of the last sample
+static int16 g_aux_uv_mv;    // Its voltage
+
+void aux_init(void)
+{
+    g_aux_uv_stage = AUX_UV_NONE;
+    g_aux_uv_count = 0;
+    g_aux_uv_cell  = 0;
+    g_aux_uv_mv    = 0;
+    aux_calibrate();
+}
+
+// Recomputes the conversion tables from the calibration parameters
+void aux_calibrate(void)
+{
+    int8 i;
+
+    for (i = 0 ; i < N_AUX_CELLS ; i++)
+    {
+        // The gain range keeps AUX_ADC_MAX * scale within 32 bits
+        g_aux_scale[i] = ((int32)param_get(PARAM_AUX1_GAIN_UV + i) << 16) / 1000;
+        g_aux_zero[i]  = param_get(PARAM_AUX1_ZERO + i);
+    }
+    gb_aux_differential = (param_get(PARAM_AUX_DIFFERENTIAL) != 0);
+}
+
+// Converts the readings of the N_AUX_CELLS inputs to millivolts
+void aux_convert(int16 * reading, int16 * mv)
+{
+    int8  i;
+    int16 tap[N_AUX_CELLS];
+
+    for (i = 0 ; i < N_AUX_CELLS ; i++)
+    {
+        tap[i] = 0;
+        if (reading[i] > g_aux_zero[i])
+        {
+            // Rounded to the nearest millivolt
+            tap[i] = (((int32)(reading[i] - g_aux_zero[i]) * g_aux_scale[i]) + 0x8000) >> 16;
+        }
+    }
+
+    mv[0] = tap[0];
+    for (i = 1 ; i < N_AUX_CELLS ; i++)
+    {
+        if (gb_aux_differential == false)
+        {
+            mv[i] = tap[i];
+        }
+        else if (tap[i] > tap[i - 1])
+        {
+            mv[i] = tap[i] - tap[i - 1];
+        }
+        else
+        {
+            mv[i] = 0;
+        }
+    }
+}
+
+// Returns the undervoltage stage with a sample of the cell voltages included
+aux_uv_t aux_check_uv(int16 * mv)
+{
+    int8     i;
+    int16    threshold;
+    aux_uv_t stage;
+
+    g_aux_uv_cell = 0;
+    for (i = 1 ; i < N_AUX_CELLS ; i++)
+    {
+        if (mv[i] < mv[g_aux_uv_cell])
+        {
+            g_aux_uv_cell = i;
+        }
+    }
+    g_aux_uv_mv = mv[g_aux_uv_cell];
+
+    // Stage this sample calls for, the thresholds of the current stage and
+    // the ones below it are raised by the hysteresis
+    stage = AUX_UV_NONE;
+    for (i = AUX_UV_WARNING ; i <= AUX_UV_CRITICAL ; i++)
+    {
+        threshold = param_get(PARAM_AUX_UV_WARNING_MV + i - AUX_UV_WARNING);
+        if (i <= g_aux_uv_stage)
+        {
+            threshold += AUX_UV_HYSTERESIS_MV;
+        }
+        if (g_aux_uv_mv < threshold)
+        {
+            stage = i;
+        }
+    }
+
+    if (stage == g_aux_uv_stage)
+    {
+        g_aux_uv_count = 0;
+    }
+    else if (++g_aux_uv_count >= AUX_UV_DEBOUNCE)
+    {
+        g_aux_uv_stage = stage;
+        g_aux_uv_count = 0;
+    }
+    return g_aux_uv_stage;
+}
+
+// Returns the lowest cell (0-3) of the last sample
+int8 aux_uv_cell(void)
+{
+    return g_aux_uv_cell;
+}
+
+// Returns the voltage of the lowest cell of the last sample in mV
+int16 aux_uv_mv(void)
+{
+    return g_aux_uv_mv;
+}
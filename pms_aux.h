@@ -0,0 +1,70 @@
+#ifndef PMS_AUX_H
+#define PMS_AUX_H
+
+// Aux pack cell voltages
+// Converts the aux pack ADC readings to millivolts with a per-channel
+// calibration kept in the runtime parameters (pms_param.h), so every board can
+// be trimmed over CAN bus without reflashing.
+//
+// Each input is calibrated by a gain in microvolts per ADC count and a zero,
+// the ADC count read with the input at 0V:
+//   tap (mV) = (reading - zero) * gain / 1000
+// The division is never done per reading. aux_calibrate turns every gain into
+// a 16.16 fixed point scale once, so a conversion is one 32-bit multiply and a
+// shift, with no floating point. It must be called whenever a gain changes.
+//
+// The inputs are cumulative taps of the pack, input n measures cells 1 to n
+// against the pack negative. In differential mode (PARAM_AUX_DIFFERENTIAL)
+// each cell voltage is its tap minus the tap below it, a cell that reads
+// below 0 is reported as 0. Otherwise the tap voltages are reported as is.
+//
+// The filtered results are sent in CAN_PMS_DATA, see pms_soc.h.
+//
+// Undervoltage protection: aux_check_uv compares the lowest cell of every
+// sample with three thresholds and returns a stage that the PMS sheds load
+// by, so a sagging aux pack degrades the PMS gracefully instead of letting it
+// brown out. Each stage keeps the load shedding of the stages before it:
+//   AUX_UV_WARNING   horn locked out
+//   AUX_UV_SHED      motor relay held at AUX_UV_HOLD_DUTY
+//   AUX_UV_CRITICAL  CAN_PMS_DATA slowed to AUX_UV_SENDING_PERIOD_MS
+// A stage is entered once the lowest cell has been below its threshold for
+// AUX_UV_DEBOUNCE samples in a row, and left once it has been back above
+// the threshold by AUX_UV_HYSTERESIS_MV for as long, so a single bad sample
+// or a short sag never changes the stage.
+//
+// AUX_UV_CRITICAL only slows the data pages. An active fault still sends
+// CAN_PMS_FAULT, and the temperature alarm, every
+// PARAM_FAULT_SENDING_PERIOD_MS, the fault page is what tells the driver
+// why the PMS is shedding load.
+
+#define N_AUX_CELLS       4
+#define AUX_ADC_MAX    4095 // Largest reading of the 12-bit ADC
+
+// Aux cell undervoltage limits
+// The thresholds are the defaults of the runtime parameters in pms_param.h,
+// in mV per cell
+#define AUX_UV_WARNING_MV         3400
+#define AUX_UV_SHED_MV            3300
+#define AUX_UV_CRITICAL_MV        3200
+#define AUX_UV_HYSTERESIS_MV        50 // A stage clears this far above its threshold
+#define AUX_UV_DEBOUNCE             10 // Samples in a row before the stage changes
+#define AUX_UV_HOLD_DUTY            30 // Motor relay hold duty from AUX_UV_SHED, the lowest the parameter allows
+#define AUX_UV_SENDING_PERIOD_MS  5000 // CAN_PMS_DATA period from AUX_UV_CRITICAL
+
+// Stages in increasing order of severity
+typedef enum
+{
+    AUX_UV_NONE,
+    AUX_UV_WARNING,
+    AUX_UV_SHED,
+    AUX_UV_CRITICAL
+} aux_uv_t;
+
+void     aux_init(void);
+void     aux_calibrate(void);
+void     aux_convert(int16 * reading, int16 * mv);
+aux_uv_t aux_check_uv(int16 * mv);
+int8     aux_uv_cell(void);
+int16    aux_uv_mv(void);
+
+#endif
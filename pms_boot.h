@@ -0,0 +1,99 @@
+#ifndef PMS_BOOT_H
+#define PMS_BOOT_H
+
+// CAN bootloader
+// bootloader.c is a separate program that stays resident at the bottom of
+// program memory, the PMS application is linked above it (see main.h) and
+// can be replaced over CAN bus without a PICkit. tools/pms_flash.c is the
+// host side.
+//
+// Memory map:
+//   0x0000 - BOOT_APP_START-1   bootloader, its interrupt vectors forward to
+//                               the application's
+//   BOOT_APP_START - BOOT_APP_END  application, reset vector at
+//                               BOOT_APP_START, interrupts at +0x08 and +0x18
+//
+// At reset the bootloader reads the boot record kept at the end of the data
+// EEPROM. It starts the application straight away if the record says the
+// image passed its CRC check and no update was requested, otherwise it
+// stays in loader mode and announces itself with BOOT_OP_READY. The update
+// request is cleared once READY has been sent, so a session abandoned before
+// BOOT_OP_START leaves the application to start at the next reset. An update
+// that was interrupted after BOOT_OP_START leaves the record invalid, so the
+// PMS comes back up in the loader and the update can simply be run again. An
+// image that boots but cannot answer BOOT_OP_ENTER has to be reflashed with
+// the PICkit.
+//
+// Protocol, the host sends on COMMAND_PMS_BOOT and the PMS answers on
+// RESPONSE_PMS_BOOT with byte 0 the operation and byte 1 a BOOT_xxx status.
+// Multi-byte fields are little endian.
+//   BOOT_OP_ENTER   key (16-bit)
+//                   The application checks the key, sets the update request
+//                   in the boot record and resets into the loader, it refuses
+//                   with BOOT_BUSY while the motor relay is closed or the
+//                   motor is precharging.
+//   BOOT_OP_READY   (PMS only) status, BOOT_VERSION, reason the loader is
+//                   running (BOOT_REASON_xxx), block size
+//   BOOT_OP_START   image length, CRC (16-bit each)
+//                   Invalidates the boot record and starts an update.
+//   BOOT_OP_DATA    0x80 + n, n = 0 - 9, one block of BOOT_BLOCK_SIZE bytes
+//                   in 10 frames. Frame 0 carries the block number (16-bit)
+//                   and bytes 0-4, frame n the 7 bytes from 7n - 2. The PMS
+//                   answers every block with BOOT_OP_DATA, status, block
+//                   number once it is written. A block whose frames are not
+//                   all received before the next block starts is answered
+//                   with BOOT_INCOMPLETE.
+//   BOOT_OP_FINISH  Reads the image back and checks the CRC, the boot record
+//                   is only made valid if it matches.
+//   BOOT_OP_RUN     Resets, the loader then starts the application if the
+//                   image is valid.
+// The host keeps BOOT_WINDOW blocks in flight, so the PMS is writing one
+// block while the next arrives, and goes back to the oldest block not
+// acknowledged after a refusal or BOOT_ACK_TIMEOUT_MS of silence.
+//
+// The CRC is CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) over the
+// image length bytes from BOOT_APP_START. The host pads the image with 0xFF
+// to a whole number of blocks.
+
+#define BOOT_VERSION              1
+#define BOOT_APP_START       0x2000 // First address of the application, a multiple of BOOT_BLOCK_SIZE
+#define BOOT_APP_END         0xFFFF // Last address of program memory
+#define BOOT_BLOCK_SIZE          64 // Flash erase and write block of the PIC18F26K80
+#define BOOT_BLOCK_FRAMES        10 // Data frames per block
+#define BOOT_WINDOW               2 // Blocks the host sends ahead of the acknowledgements
+#define BOOT_ACK_TIMEOUT_MS     250 // Host wait for an acknowledgement before resending
+#define BOOT_KEY             0xF1A5
+
+// Boot record, the last bytes of the data EEPROM
+#define BOOT_RECORD           0x3F8
+#define BOOT_RECORD_IMAGE         0 // BOOT_IMAGE_VALID once the image has passed its CRC check
+#define BOOT_RECORD_REQUEST       1 // BOOT_REQUEST_ENTER when the application asks for the loader
+#define BOOT_RECORD_LEN           2 // Image length (16-bit)
+#define BOOT_RECORD_CRC           4 // Image CRC (16-bit)
+#define BOOT_IMAGE_VALID       0x5A
+#define BOOT_REQUEST_ENTER     0xB7
+
+// Operations, byte 0 of every frame
+#define BOOT_OP_READY          0x00
+#define BOOT_OP_ENTER          0x01
+#define BOOT_OP_START          0x02
+#define BOOT_OP_FINISH         0x03
+#define BOOT_OP_RUN            0x04
+#define BOOT_OP_DATA           0x80
+
+// Status, byte 1 of every response
+#define BOOT_OK                   0
+#define BOOT_BAD_KEY              1 // Wrong key, nothing changed
+#define BOOT_BUSY                 2 // The motor relay is closed or precharging, the application keeps running
+#define BOOT_BAD_STATE            3 // No update started
+#define BOOT_BAD_BLOCK            4 // Block outside the image or the application area, or image too long
+#define BOOT_INCOMPLETE           5 // Frames of the block were lost, send it again
+#define BOOT_BAD_CRC              6 // The image read back does not match the CRC
+#define BOOT_BAD_OP               7 // Unknown operation
+
+// Why the loader is running, byte 3 of BOOT_OP_READY
+#define BOOT_REASON_REQUEST       1 // The application asked for an update
+#define BOOT_REASON_NO_IMAGE      2 // No valid image
+#define BOOT_REASON_COMMAND       3 // BOOT_OP_ENTER received by the loader
+
+#endif
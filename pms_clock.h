@@ -0,0 +1,34 @@
+#ifndef PMS_CLOCK_H
+#define PMS_CLOCK_H
+
+// Clock
+// Everything that depends on the oscillator frequency is worked out here from
+// CLOCK_XTAL_HZ: the delay routines, timer2 (the 1ms tick and the relay PWM)
+// and the CAN bit timing, so a different crystal only needs this file.
+//
+// The PMS runs straight from the crystal, the 4x PLL is left off (NOPLLEN).
+// The fitted 20MHz crystal would put it at 80MHz, above the 64MHz limit of
+// the PIC18F26K80.
+
+#define CLOCK_XTAL_HZ       20000000 // Crystal on OSC1/OSC2, HSH oscillator
+
+// Timer2, interrupts every 1ms and is the relay PWM time base
+#if CLOCK_XTAL_HZ == 20000000
+#define CLOCK_T2_DIV        T2_DIV_BY_4  // 1.25MHz
+#define CLOCK_T2_PR2        79           // PWM at 15.6kHz
+#define CLOCK_T2_POST       16
+#elif CLOCK_XTAL_HZ == 16000000
+#define CLOCK_T2_DIV        T2_DIV_BY_1  // 4MHz
+#define CLOCK_T2_PR2        249          // PWM at 16kHz
+#define CLOCK_T2_POST       16
+#else
+#error No timer2 setup for CLOCK_XTAL_HZ
+#endif
+
+// CAN bit timing, CAN_BIT_TQ time quanta per bit (sync 1, propagation 7,
+// phase 1 6 and phase 2 2, the CAN_BRG_ defaults in can18F4580_mscp.h)
+#define CAN_BIT_RATE        125000
+#define CAN_BIT_TQ          16
+#define CAN_BRG_PRESCALAR   (CLOCK_XTAL_HZ / (2 * CAN_BIT_TQ * CAN_BIT_RATE) - 1)
+
+#endif
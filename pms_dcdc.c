@@ -0,0 +1,63 @@
+// DC/DC converter temperature
+// dcdc_convert and dcdc_update both take constant time
+
+#include "pms_dcdc.h"
+#include "pms_dcdc_table.h"
+
+static dcdc_status_t g_dcdc_stage; // Stage of the last update, for the hysteresis
+
+void dcdc_init(void)
+{
+    g_dcdc_stage = DCDC_NORMAL;
+}
+
+// Returns the temperature in 0.1 degrees C of a 12-bit reading
+signed int16 dcdc_convert(int16 reading)
+{
+    int8         i;
+    int8         frac;
+    signed int16 t0;
+    signed int16 t1;
+
+    i    = reading >> DCDC_TABLE_SHIFT;
+    frac = reading & ((1 << DCDC_TABLE_SHIFT) - 1);
+    t0   = g_dcdc_table[i];
+    t1   = g_dcdc_table[i + 1];
+
+    // The thermistor pulls the reading down as it heats, so t0 >= t1
+    return t0 - (signed int16)(((int32)(t0 - t1) * frac) >> DCDC_TABLE_SHIFT);
+}
+
+// Returns the protection stage for a temperature in 0.1 degrees C
+// The thresholds are runtime parameters
+dcdc_status_t dcdc_update(signed int16 temp)
+{
+    signed int16 derate;
+    signed int16 critical;
+
+    derate   = (signed int16)param_get(PARAM_DCDC_TEMP_DERATE) * 10;
+    critical = (signed int16)param_get(PARAM_DCDC_TEMP_CRITICAL) * 10;
+
+    if (temp >= critical)
+    {
+        g_dcdc_stage = DCDC_CRITICAL;
+    }
+    else if (temp >= derate)
+    {
+        if ((g_dcdc_stage != DCDC_CRITICAL) || (temp < (critical - DCDC_TEMP_HYSTERESIS)))
+        {
+            g_dcdc_stage = DCDC_DERATE;
+        }
+    }
+    else if (temp < (derate - DCDC_TEMP_HYSTERESIS))
+    {
+        g_dcdc_stage = DCDC_NORMAL;
+    }
+    else if (g_dcdc_stage == DCDC_CRITICAL)
+    {
+        // Inside the derate band after cooling from critical
+        g_dcdc_stage = DCDC_DERATE;
+    }
+
+    return g_dcdc_stage;
+}
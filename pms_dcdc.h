@@ -0,0 +1,37 @@
+#ifndef PMS_DCDC_H
+#define PMS_DCDC_H
+
+// DC/DC converter temperature
+// Converts the thermistor reading on DCDC_TEMP_ADC_CHANNEL to tenths of a
+// degree C and protects the converter in two stages.
+//
+// The conversion interpolates linearly in g_dcdc_table, the temperature at
+// every 1 << DCDC_TABLE_SHIFT readings of the 12-bit ADC. The table is
+// generated from the Beta equation of the thermistor by tools/therm_table.c,
+// so a conversion is a lookup, a multiply and a shift.
+//
+// At or over the derate threshold the load on the converter is reduced, the
+// horn is locked out. At or over the critical threshold the motor is also
+// disconnected and kept off. Each stage clears once the converter has cooled
+// DCDC_TEMP_HYSTERESIS below its threshold.
+
+// DC/DC temperature limits
+// The thresholds are the defaults of the runtime parameters in pms_param.h,
+// in degrees C
+#define DCDC_TEMP_DERATE            85 // Horn locked out
+#define DCDC_TEMP_CRITICAL         100 // Motor disconnected
+#define DCDC_TEMP_HYSTERESIS        50 // A stage clears this far below its threshold, 0.1 degrees C
+
+// Stages in increasing order of severity
+typedef enum
+{
+    DCDC_NORMAL,
+    DCDC_DERATE,
+    DCDC_CRITICAL
+} dcdc_status_t;
+
+void          dcdc_init(void);
+signed int16  dcdc_convert(int16 reading);
+dcdc_status_t dcdc_update(signed int16 temp);
+
+#endif
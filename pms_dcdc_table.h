@@ -0,0 +1,24 @@
+#ifndef PMS_DCDC_TABLE_H
+#define PMS_DCDC_TABLE_H
+
+// DC/DC thermistor table, generated by tools/therm_table.c, do not edit
+// 10000 ohm NTC, B = 3435K, to ground with a 10000 ohm pull-up
+// Entry n is the temperature in 0.1 degrees C at reading n << DCDC_TABLE_SHIFT
+
+#define DCDC_TABLE_SHIFT 6
+#define DCDC_TABLE_LEN   65
+
+static const signed int16 g_dcdc_table[DCDC_TABLE_LEN] =
+{
+     1500,  1500,  1500,  1306,  1166,  1063,   981,   913,
+      856,   806,   761,   721,   685,   651,   620,   591,
+      564,   539,   514,   491,   469,   448,   427,   408,
+      388,   370,   352,   334,   316,   299,   283,   266,
+      250,   234,   218,   202,   186,   171,   155,   139,
+      123,   108,    92,    75,    59,    42,    25,     8,
+      -10,   -28,   -47,   -66,   -87,  -108,  -131,  -155,
+     -181,  -209,  -241,  -276,  -317,  -368,  -400,  -400,
+     -400
+};
+
+#endif
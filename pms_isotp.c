@@ -0,0 +1,320 @@
+// Segmented transfers
+// Every call takes constant time, a response frame fetches at most 7 bytes
+// from transfer_byte
+
+#include "pms_isotp.h"
+
+// Sender states
+#define ISOTP_TX_IDLE         0
+#define ISOTP_TX_SEND         1 // Next frame due once the separation time has passed
+#define ISOTP_TX_WAIT_FLOW    2 // Waiting for the tester's flow control
+
+static int8  g_isotp_rx[ISOTP_RX_MAX];
+static int8  g_isotp_rx_len;        // Length of the request being received
+static int8  g_isotp_rx_pos;        // Bytes received so far
+static int8  g_isotp_rx_seq;        // Sequence number of the next consecutive frame
+static int8  g_isotp_rx_block;      // Consecutive frames left before the next flow control
+static int32 g_isotp_rx_ms;         // Tick of the last frame of the request
+static int1  gb_isotp_rx_busy;      // A segmented request is being received
+static int8  g_isotp_flow[3];       // Flow control frame to send
+static int16 g_isotp_tx_len;        // Length of the response
+static int16 g_isotp_tx_pos;        // Bytes sent so far
+static int8  g_isotp_tx_state;
+static int8  g_isotp_tx_seq;        // Sequence number of the next consecutive frame
+static int8  g_isotp_tx_bs;         // Block size of the last flow control, 0 for no limit
+static int8  g_isotp_tx_block;      // Consecutive frames left in the block
+static int8  g_isotp_tx_st;         // Separation time in ms
+static int8  g_isotp_tx_gap;        // Separation time before the next frame, 0 to send at once
+static int8  g_isotp_tx_waits;      // Flow control waits in a row
+static int32 g_isotp_tx_ms;         // Tick of the last frame sent or flow control received
+
+void isotp_init(void)
+{
+    gb_isotp_rx_busy = false;
+    g_isotp_rx_len   = 0;
+    g_isotp_tx_state = ISOTP_TX_IDLE;
+}
+
+// Stores a flow control frame for the application to send
+void isotp_flow(int8 status)
+{
+    g_isotp_flow[0] = ISOTP_FLOW | status;
+    g_isotp_flow[1] = ISOTP_BLOCK_SIZE;
+    g_isotp_flow[2] = ISOTP_ST_MIN;
+}
+
+// Copies the flow control frame left by isotp_receive, returns its length
+int8 isotp_flow_frame(int8 * frame)
+{
+    int8 i;
+
+    for (i = 0 ; i < ISOTP_FRAME_LEN ; i++)
+    {
+        frame[i] = 0;
+    }
+    frame[0] = g_isotp_flow[0];
+    frame[1] = g_isotp_flow[1];
+    frame[2] = g_isotp_flow[2];
+    return ISOTP_FRAME_LEN;
+}
+
+// Takes a frame received on COMMAND_PMS_TRANSFER at tick now
+// Returns one of the ISOTP_RX_xxx results
+int8 isotp_receive(int8 * data, int8 len, int32 now)
+{
+    int8  i;
+    int8  n;
+    int16 total;
+
+    if (len == 0)
+    {
+        return ISOTP_RX_NONE;
+    }
+
+    switch(data[0] & 0xF0)
+    {
+        case ISOTP_SINGLE:
+            n = data[0] & 0x0F;
+            if ((n == 0) || (n >= len))
+            {
+                return ISOTP_RX_NONE;
+            }
+            for (i = 0 ; i < n ; i++)
+            {
+                g_isotp_rx[i] = data[i + 1];
+            }
+            g_isotp_rx_len   = n;
+            gb_isotp_rx_busy = false;
+            g_isotp_tx_state = ISOTP_TX_IDLE;
+            return ISOTP_RX_DONE;
+
+        case ISOTP_FIRST:
+            if (len < ISOTP_FRAME_LEN)
+            {
+                return ISOTP_RX_NONE;
+            }
+            total = make16(data[0] & 0x0F,data[1]);
+            if (total < ISOTP_FRAME_LEN)
+            {
+                return ISOTP_RX_NONE;
+            }
+            g_isotp_tx_state = ISOTP_TX_IDLE;
+            if (total > ISOTP_RX_MAX)
+            {
+                gb_isotp_rx_busy = false;
+                isotp_flow(ISOTP_FLOW_OVERFLOW);
+                return ISOTP_RX_FLOW;
+            }
+            for (i = 0 ; i < 6 ; i++)
+            {
+                g_isotp_rx[i] = data[i + 2];
+            }
+            g_isotp_rx_len   = total;
+            g_isotp_rx_pos   = 6;
+            g_isotp_rx_seq   = 1;
+            g_isotp_rx_block = ISOTP_BLOCK_SIZE;
+            g_isotp_rx_ms    = now;
+            gb_isotp_rx_busy = true;
+            isotp_flow(ISOTP_FLOW_CTS);
+            return ISOTP_RX_FLOW;
+
+        case ISOTP_CONSECUTIVE:
+            if (gb_isotp_rx_busy == false)
+            {
+                return ISOTP_RX_NONE;
+            }
+            n = g_isotp_rx_len - g_isotp_rx_pos;
+            if (n > 7)
+            {
+                n = 7;
+            }
+            if (((now - g_isotp_rx_ms) > ISOTP_TIMEOUT_MS) || ((data[0] & 0x0F) != g_isotp_rx_seq) ||
+                (n >= len))
+            {
+                // Late, out of order or short, the tester has to start again
+                gb_isotp_rx_busy = false;
+                return ISOTP_RX_NONE;
+            }
+            for (i = 0 ; i < n ; i++)
+            {
+                g_isotp_rx[g_isotp_rx_pos + i] = data[i + 1];
+            }
+            g_isotp_rx_pos += n;
+            g_isotp_rx_seq  = (g_isotp_rx_seq + 1) & 0x0F;
+            g_isotp_rx_ms   = now;
+            if (g_isotp_rx_pos >= g_isotp_rx_len)
+            {
+                gb_isotp_rx_busy = false;
+                return ISOTP_RX_DONE;
+            }
+            if (--g_isotp_rx_block == 0)
+            {
+                g_isotp_rx_block = ISOTP_BLOCK_SIZE;
+                isotp_flow(ISOTP_FLOW_CTS);
+                return ISOTP_RX_FLOW;
+            }
+            return ISOTP_RX_NONE;
+
+        case ISOTP_FLOW:
+            if ((g_isotp_tx_state != ISOTP_TX_WAIT_FLOW) || (len < 3))
+            {
+                return ISOTP_RX_NONE;
+            }
+            switch(data[0] & 0x0F)
+            {
+                case ISOTP_FLOW_CTS:
+                    g_isotp_tx_bs    = data[1];
+                    g_isotp_tx_block = data[1];
+                    g_isotp_tx_st    = data[2];
+                    if ((data[2] >= 0xF1) && (data[2] <= 0xF9))
+                    {
+                        g_isotp_tx_st = 1;
+                    }
+                    else if (data[2] > 0x7F)
+                    {
+                        // Reserved, use the longest separation time
+                        g_isotp_tx_st = 0x7F;
+                    }
+                    g_isotp_tx_gap   = 0;
+                    g_isotp_tx_state = ISOTP_TX_SEND;
+                    break;
+                case ISOTP_FLOW_WAIT:
+                    g_isotp_tx_ms = now;
+                    if (++g_isotp_tx_waits > ISOTP_WAIT_MAX)
+                    {
+                        g_isotp_tx_state = ISOTP_TX_IDLE;
+                    }
+                    break;
+                default:
+                    // Overflow or unknown, abandon the response
+                    g_isotp_tx_state = ISOTP_TX_IDLE;
+                    break;
+            }
+            return ISOTP_RX_NONE;
+
+        default:
+            return ISOTP_RX_NONE;
+    }
+}
+
+// Returns the byte at index of the last complete request
+int8 isotp_request(int8 index)
+{
+    return g_isotp_rx[index];
+}
+
+int8 isotp_request_len(void)
+{
+    return g_isotp_rx_len;
+}
+
+// Starts a response of len bytes, replacing any response in progress
+void isotp_send(int16 len, int32 now)
+{
+    if (len > ISOTP_TX_MAX)
+    {
+        len = ISOTP_TX_MAX;
+    }
+    g_isotp_tx_len   = len;
+    g_isotp_tx_pos   = 0;
+    g_isotp_tx_gap   = 0;
+    g_isotp_tx_ms    = now;
+    g_isotp_tx_state = ISOTP_TX_SEND;
+}
+
+int1 isotp_tx_pending(void)
+{
+    return (g_isotp_tx_state != ISOTP_TX_IDLE);
+}
+
+// Returns true if the next frame of the response is due at tick now
+// A response whose tester has stopped sending flow control is abandoned here
+int1 isotp_tx_ready(int32 now)
+{
+    if (g_isotp_tx_state == ISOTP_TX_WAIT_FLOW)
+    {
+        if ((now - g_isotp_tx_ms) > ISOTP_TIMEOUT_MS)
+        {
+            g_isotp_tx_state = ISOTP_TX_IDLE;
+        }
+        return false;
+    }
+    if (g_isotp_tx_state != ISOTP_TX_SEND)
+    {
+        return false;
+    }
+
+    // now may be about to tick over, one extra tick makes sure the whole
+    // separation time has passed
+    return ((g_isotp_tx_gap == 0) || ((now - g_isotp_tx_ms) > g_isotp_tx_gap));
+}
+
+// Fills frame with the next frame of the response and returns its length
+// Only call when isotp_tx_ready returns true
+int8 isotp_tx_frame(int8 * frame, int32 now)
+{
+    int8 i;
+    int8 n;
+    int8 pci;
+
+    for (i = 0 ; i < ISOTP_FRAME_LEN ; i++)
+    {
+        frame[i] = 0;
+    }
+
+    if ((g_isotp_tx_pos == 0) && (g_isotp_tx_len < ISOTP_FRAME_LEN))
+    {
+        // Fits a single frame
+        frame[0] = ISOTP_SINGLE | g_isotp_tx_len;
+        for (i = 0 ; i < g_isotp_tx_len ; i++)
+        {
+            frame[i + 1] = transfer_byte(i);
+        }
+        g_isotp_tx_state = ISOTP_TX_IDLE;
+        return ISOTP_FRAME_LEN;
+    }
+
+    if (g_isotp_tx_pos == 0)
+    {
+        frame[0] = ISOTP_FIRST | make8(g_isotp_tx_len,1);
+        frame[1] = make8(g_isotp_tx_len,0);
+        pci      = 2;
+        n        = 6;
+        g_isotp_tx_seq   = 1;
+        g_isotp_tx_waits = 0;
+        g_isotp_tx_state = ISOTP_TX_WAIT_FLOW;
+    }
+    else
+    {
+        frame[0] = ISOTP_CONSECUTIVE | g_isotp_tx_seq;
+        pci      = 1;
+        n        = 7;
+        if ((g_isotp_tx_len - g_isotp_tx_pos) < 7)
+        {
+            n = g_isotp_tx_len - g_isotp_tx_pos;
+        }
+        g_isotp_tx_seq = (g_isotp_tx_seq + 1) & 0x0F;
+        g_isotp_tx_gap = g_isotp_tx_st;
+    }
+
+    for (i = 0 ; i < n ; i++)
+    {
+        frame[pci + i] = transfer_byte(g_isotp_tx_pos + i);
+    }
+    g_isotp_tx_pos += n;
+    g_isotp_tx_ms   = now;
+
+    if (pci == 1)
+    {
+        if (g_isotp_tx_pos >= g_isotp_tx_len)
+        {
+            g_isotp_tx_state = ISOTP_TX_IDLE;
+        }
+        else if ((g_isotp_tx_bs != 0) && (--g_isotp_tx_block == 0))
+        {
+            g_isotp_tx_waits = 0;
+            g_isotp_tx_state = ISOTP_TX_WAIT_FLOW;
+        }
+    }
+    return ISOTP_FRAME_LEN;
+}
@@ -0,0 +1,73 @@
+#ifndef PMS_ISOTP_H
+#define PMS_ISOTP_H
+
+// Segmented transfers
+// Moves messages longer than a CAN frame between the PMS and a tester, in the
+// frame format of ISO 15765-2 (ISO-TP). The tester sends requests on
+// COMMAND_PMS_TRANSFER and the PMS replies on RESPONSE_PMS_TRANSFER, each
+// side sends its flow control frames on its own ID.
+//
+// Byte 0 of every frame is the protocol control information (PCI):
+//   Single      0x0L, L = length (1-7), then the data
+//   First       0x1L LL, 12-bit length (8-4095), then the first 6 data bytes
+//   Consecutive 0x2N, N = sequence number (1, 2, ... 15, 0, 1, ...), then up
+//               to 7 data bytes
+//   Flow        0x3S, S = ISOTP_FLOW_xxx status, block size, separation time
+//
+// After a first frame the receiver sends a flow control frame. The sender
+// then sends block size consecutive frames (0 for all of them) at least the
+// separation time apart and waits for the next flow control frame. The
+// separation time is in ms (0-127), 0xF1-0xF9 (100-900us) are rounded up to
+// 1ms, the tick of the PMS. Either side gives up when the other has been
+// silent for ISOTP_TIMEOUT_MS.
+//
+// Requests are received into a buffer of ISOTP_RX_MAX bytes, a longer first
+// frame is refused with ISOTP_FLOW_OVERFLOW. Responses are not buffered, the
+// frames are built as they are sent and every data byte is fetched from
+// transfer_byte, which the application provides. That lets a response cover
+// the whole data EEPROM with a few bytes of RAM.
+//
+// isotp_receive is given every frame received on COMMAND_PMS_TRANSFER.
+// Sending is driven from the main loop, isotp_tx_ready says when the next
+// frame of a response is due and isotp_tx_frame builds it, so a transfer
+// never blocks and runs as fast as the tester's flow control and the
+// transmit buffers allow. A new request cancels the transfer in progress.
+
+#define ISOTP_RX_MAX         64 // Longest request
+#define ISOTP_TX_MAX       4095 // Longest response, the limit of the 12-bit length
+#define ISOTP_BLOCK_SIZE      8 // Consecutive frames the PMS accepts per flow control frame
+#define ISOTP_ST_MIN          2 // Separation time the PMS asks for, in ms
+#define ISOTP_TIMEOUT_MS   1000 // Longest wait for the other side
+#define ISOTP_WAIT_MAX        8 // Flow control waits accepted in a row before giving up
+#define ISOTP_FRAME_LEN       8 // Every frame is padded to this length
+
+// PCI frame types, high nibble of byte 0
+#define ISOTP_SINGLE       0x00
+#define ISOTP_FIRST        0x10
+#define ISOTP_CONSECUTIVE  0x20
+#define ISOTP_FLOW         0x30
+
+// Flow control status, low nibble of byte 0
+#define ISOTP_FLOW_CTS        0 // Continue to send
+#define ISOTP_FLOW_WAIT       1 // Wait for another flow control frame
+#define ISOTP_FLOW_OVERFLOW   2 // Message too long, abort
+
+// isotp_receive results
+#define ISOTP_RX_NONE         0 // Nothing for the application to do
+#define ISOTP_RX_FLOW         1 // Send the flow control frame left in the frame buffer
+#define ISOTP_RX_DONE         2 // A complete request is waiting, see isotp_request
+
+void  isotp_init(void);
+int8  isotp_receive(int8 * data, int8 len, int32 now);
+int8  isotp_request(int8 index);
+int8  isotp_request_len(void);
+void  isotp_send(int16 len, int32 now);
+int1  isotp_tx_pending(void);
+int1  isotp_tx_ready(int32 now);
+int8  isotp_tx_frame(int8 * frame, int32 now);
+int8  isotp_flow_frame(int8 * frame);
+
+// Provided by the application, returns the byte at offset of the response being sent
+int8  transfer_byte(int16 offset);
+
+#endif
@@ -0,0 +1,363 @@
+// Persistent fault and counter log
+// Logging only updates RAM, the EEPROM is written in the background by
+// log_service
+
+#include "pms_log.h"
+
+#byte EECON1 = getenv("SFR:EECON1")     //0xF7F
+#bit  EECON1_WR = EECON1.1              // Set while a data EEPROM write is in progress
+
+#define LOG_WRITE_NONE     0
+#define LOG_WRITE_COUNTERS 1
+#define LOG_WRITE_FAULT    2
+
+static int16 g_log_counter[N_LOG_COUNTERS];
+static int8  g_log_dcdc_max;                 // Hottest DC/DC temperature reading
+static int16 g_log_counter_seq;              // Sequence number of the next counter record
+static int8  g_log_counter_head;             // Slot of the next counter record
+static int16 g_log_fault_seq;                // Sequence number of the next fault record
+static int8  g_log_fault_head;               // Slot of the next fault record
+static int8  g_log_fault_count;              // Valid fault records in the EEPROM
+static int1  gb_log_dirty;                   // Counters changed since the last snapshot
+static int1  gb_log_urgent;                  // Write a snapshot without waiting for the period
+static int32 g_log_snapshot_ms;              // Tick the last snapshot was started
+
+static int8  g_log_queue[LOG_QUEUE_DEPTH][LOG_FAULT_LEN];
+static int8  g_log_queue_head;               // Next fault to be written
+static int8  g_log_queue_count;
+
+static int8  g_log_write[LOG_COUNTER_LEN];   // Record being written
+static int16 g_log_write_addr;
+static int8  g_log_write_len;
+static int8  g_log_write_pos;
+static int8  g_log_write_kind;
+
+static int1  gb_log_dumping = false;
+static int8  g_log_dump_seq;
+static int8  g_log_dump_faults;
+
+// CRC-8, polynomial 0x07, initial value 0xFF so erased and blank records fail
+int8 crc8(int8 * data, int8 len)
+{
+    int8 crc;
+    int8 i;
+    int8 b;
+
+    crc = 0xFF;
+    for (i = 0 ; i < len ; i++)
+    {
+        crc ^= data[i];
+        for (b = 0 ; b < 8 ; b++)
+        {
+            if (bit_test(crc,7))
+            {
+                crc = (crc << 1) ^ 0x07;
+            }
+            else
+            {
+                crc <<= 1;
+            }
+        }
+    }
+    return crc;
+}
+
+// Reads a record into buf, returns true if its CRC matches
+int1 log_read_record(int16 addr, int8 * buf, int8 len)
+{
+    int8 i;
+
+    for (i = 0 ; i < len ; i++)
+    {
+        buf[i] = read_eeprom(addr + i);
+    }
+    return (crc8(buf,len - 1) == buf[len - 1]);
+}
+
+// Finds the newest valid record of a ring
+// Returns the slot after it, or 0 with seq left at 0 if the ring is empty
+int8 log_find_head(int16 base, int8 slots, int8 len, int16 * seq, int8 * count)
+{
+    int8  i;
+    int8  head;
+    int16 s;
+    int1  b_found;
+
+    head = 0;
+    *seq = 0;
+    *count = 0;
+    b_found = false;
+    for (i = 0 ; i < slots ; i++)
+    {
+        if (log_read_record(base + (int16)i * len,g_log_write,len) == true)
+        {
+            (*count)++;
+            s = make16(g_log_write[1],g_log_write[0]);
+            // Sequence numbers are compared by subtraction so they may wrap
+            if ((b_found == false) || ((signed int16)(s - *seq) > 0))
+            {
+                *seq = s;
+                head = i;
+                b_found = true;
+            }
+        }
+    }
+
+    if (b_found == true)
+    {
+        (*seq)++;
+        head = (head + 1) & (slots - 1);
+    }
+    return head;
+}
+
+// Restores the counters and finds the head of both rings, then counts the boot
+void log_init(void)
+{
+    int8 i;
+    int8 count;
+
+    for (i = 0 ; i < N_LOG_COUNTERS ; i++)
+    {
+        g_log_counter[i] = 0;
+    }
+    g_log_dcdc_max = 0;
+
+    g_log_counter_head = log_find_head(LOG_COUNTER_BASE,LOG_COUNTER_SLOTS,LOG_COUNTER_LEN,&g_log_counter_seq,&count);
+    if (count > 0)
+    {
+        log_read_record(LOG_COUNTER_BASE + (int16)((g_log_counter_head - 1) & (LOG_COUNTER_SLOTS - 1)) * LOG_COUNTER_LEN,
+                        g_log_write,LOG_COUNTER_LEN);
+        for (i = 0 ; i < N_LOG_COUNTERS ; i++)
+        {
+            g_log_counter[i] = make16(g_log_write[3 + 2 * i],g_log_write[2 + 2 * i]);
+        }
+        g_log_dcdc_max = g_log_write[2 + 2 * N_LOG_COUNTERS];
+    }
+
+    g_log_fault_head = log_find_head(LOG_FAULT_BASE,LOG_FAULT_SLOTS,LOG_FAULT_LEN,&g_log_fault_seq,&g_log_fault_count);
+
+    g_log_queue_head  = 0;
+    g_log_queue_count = 0;
+    g_log_write_len   = 0;
+    g_log_write_pos   = 0;
+    g_log_write_kind  = LOG_WRITE_NONE;
+    g_log_snapshot_ms = 0;
+
+    // Record the boot straight away
+    log_count(LOG_BOOTS);
+    gb_log_urgent = true;
+}
+
+void log_count(log_counter_t counter)
+{
+    if (g_log_counter[counter] < 0xFFFF)
+    {
+        g_log_counter[counter]++;
+    }
+    gb_log_dirty = true;
+}
+
+// Keeps the hottest DC/DC converter reading
+void log_dcdc_temp(int8 temp)
+{
+    if (temp > g_log_dcdc_max)
+    {
+        g_log_dcdc_max = temp;
+        gb_log_dirty = true;
+    }
+}
+
+// Queues a fault record, followed by a counter snapshot
+void log_fault(trace_event_t event, int16 arg)
+{
+    int8 * record;
+    int32  seconds;
+
+    log_count(LOG_FAULTS);
+    gb_log_urgent = true;
+    if (g_log_queue_count >= LOG_QUEUE_DEPTH)
+    {
+        return;
+    }
+
+    seconds = tick_ms() / 1000;
+    if (seconds > 0xFFFF)
+    {
+        seconds = 0xFFFF;
+    }
+
+    record = g_log_queue[(g_log_queue_head + g_log_queue_count) % LOG_QUEUE_DEPTH];
+    record[0] = make8(g_log_fault_seq,0);
+    record[1] = make8(g_log_fault_seq,1);
+    record[2] = event;
+    record[3] = make8(arg,0);
+    record[4] = make8(arg,1);
+    record[5] = make8(seconds,0);
+    record[6] = make8(seconds,1);
+    record[7] = crc8(record,LOG_FAULT_LEN - 1);
+    g_log_fault_seq++;
+    g_log_queue_count++;
+}
+
+// Builds the next record to be written, the fault queue goes first
+void log_next_record(void)
+{
+    int8 i;
+
+    if (g_log_queue_count > 0)
+    {
+        memcpy(g_log_write,g_log_queue[g_log_queue_head],LOG_FAULT_LEN);
+        g_log_queue_head = (g_log_queue_head + 1) % LOG_QUEUE_DEPTH;
+        g_log_queue_count--;
+        g_log_write_addr = LOG_FAULT_BASE + (int16)g_log_fault_head * LOG_FAULT_LEN;
+        g_log_write_len  = LOG_FAULT_LEN;
+        g_log_write_kind = LOG_WRITE_FAULT;
+    }
+    else if ((gb_log_dirty == true) &&
+             ((gb_log_urgent == true) || ((tick_ms() - g_log_snapshot_ms) >= LOG_COUNTER_PERIOD_MS)))
+    {
+        g_log_write[0] = make8(g_log_counter_seq,0);
+        g_log_write[1] = make8(g_log_counter_seq,1);
+        for (i = 0 ; i < N_LOG_COUNTERS ; i++)
+        {
+            g_log_write[2 + 2 * i] = make8(g_log_counter[i],0);
+            g_log_write[3 + 2 * i] = make8(g_log_counter[i],1);
+        }
+        g_log_write[2 + 2 * N_LOG_COUNTERS] = g_log_dcdc_max;
+        g_log_write[LOG_COUNTER_LEN - 1] = crc8(g_log_write,LOG_COUNTER_LEN - 1);
+        g_log_write_addr = LOG_COUNTER_BASE + (int16)g_log_counter_head * LOG_COUNTER_LEN;
+        g_log_write_len  = LOG_COUNTER_LEN;
+        g_log_write_kind = LOG_WRITE_COUNTERS;
+        gb_log_dirty  = false;
+        gb_log_urgent = false;
+        g_log_snapshot_ms = tick_ms();
+    }
+    else
+    {
+        return;
+    }
+    g_log_write_pos = 0;
+}
+
+// Background writer, called on every pass through the idle state
+// Starts at most one EEPROM byte write and returns without waiting for it
+void log_service(void)
+{
+    int16 addr;
+
+    if (EECON1_WR == 1)
+    {
+        // The previous byte is still being written
+        return;
+    }
+
+    if (g_log_write_pos < g_log_write_len)
+    {
+        addr = g_log_write_addr + g_log_write_pos;
+        if (read_eeprom(addr) != g_log_write[g_log_write_pos])
+        {
+            write_eeprom(addr,g_log_write[g_log_write_pos]);
+        }
+        g_log_write_pos++;
+        return;
+    }
+
+    // The last byte of the record has been written, it is now the newest
+    if (g_log_write_kind == LOG_WRITE_FAULT)
+    {
+        g_log_fault_head = (g_log_fault_head + 1) & (LOG_FAULT_SLOTS - 1);
+        if (g_log_fault_count < LOG_FAULT_SLOTS)
+        {
+            g_log_fault_count++;
+        }
+    }
+    else if (g_log_write_kind == LOG_WRITE_COUNTERS)
+    {
+        g_log_counter_seq++;
+        g_log_counter_head = (g_log_counter_head + 1) & (LOG_COUNTER_SLOTS - 1);
+    }
+    g_log_write_kind = LOG_WRITE_NONE;
+    g_log_write_len  = 0;
+    g_log_write_pos  = 0;
+
+    log_next_record();
+}
+
+int16 log_counter(log_counter_t counter)
+{
+    return g_log_counter[counter];
+}
+
+// Starts streaming the log, restarts the dump if one is in progress
+void log_dump_start(int8 max_faults)
+{
+    g_log_dump_faults = g_log_fault_count;
+    if ((max_faults > 0) && (max_faults < g_log_dump_faults))
+    {
+        g_log_dump_faults = max_faults;
+    }
+    gb_log_dumping = true;
+    g_log_dump_seq = 0;
+}
+
+// Returns true when a dump frame is ready, frames wait for an EEPROM byte
+// write in progress since the EEPROM cannot be read during one
+int1 log_dump_pending(void)
+{
+    return ((gb_log_dumping == true) && (EECON1_WR == 0));
+}
+
+// Fills frame with the next dump frame and returns its length
+// The dump ends after the oldest requested fault has been returned
+int8 log_dump_frame(int8 * frame)
+{
+    int8 record[LOG_FAULT_LEN];
+    int8 i;
+
+    frame[0] = g_log_dump_seq;
+    if (g_log_dump_seq == 0)
+    {
+        frame[1] = g_log_dump_faults;
+        frame[2] = make8(g_log_counter[LOG_BOOTS],0);
+        frame[3] = make8(g_log_counter[LOG_BOOTS],1);
+        frame[4] = make8(g_log_counter[LOG_BPS_TRIPS],0);
+        frame[5] = make8(g_log_counter[LOG_BPS_TRIPS],1);
+        frame[6] = make8(g_log_counter[LOG_PRECHARGES],0);
+        frame[7] = make8(g_log_counter[LOG_PRECHARGES],1);
+    }
+    else if (g_log_dump_seq == 1)
+    {
+        frame[1] = make8(g_log_counter[LOG_ARRAY_CYCLES],0);
+        frame[2] = make8(g_log_counter[LOG_ARRAY_CYCLES],1);
+        frame[3] = make8(g_log_counter[LOG_MOTOR_CYCLES],0);
+        frame[4] = make8(g_log_counter[LOG_MOTOR_CYCLES],1);
+        frame[5] = make8(g_log_counter[LOG_FAULTS],0);
+        frame[6] = make8(g_log_counter[LOG_FAULTS],1);
+        frame[7] = g_log_dcdc_max;
+    }
+    else
+    {
+        // Faults are sent newest first
+        i = (g_log_fault_head - (g_log_dump_seq - 1)) & (LOG_FAULT_SLOTS - 1);
+        log_read_record(LOG_FAULT_BASE + (int16)i * LOG_FAULT_LEN,record,LOG_FAULT_LEN);
+        frame[1] = record[2]; // Event
+        frame[2] = record[3]; // Argument
+        frame[3] = record[4];
+        frame[4] = record[5]; // Seconds since boot
+        frame[5] = record[6];
+        frame[6] = record[0]; // Record sequence
+        frame[7] = record[1];
+    }
+
+    if (g_log_dump_seq >= g_log_dump_faults + 1)
+    {
+        gb_log_dumping = false;
+    }
+    else
+    {
+        g_log_dump_seq++;
+    }
+
+    return LOG_FRAME_LEN;
+}
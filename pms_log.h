@@ -0,0 +1,82 @@
+#ifndef PMS_LOG_H
+#define PMS_LOG_H
+
+// Persistent fault and counter log
+// Lifetime counters and a history of faults kept in the data EEPROM, so relay
+// wear and the cause of a BPS trip survive a reset.
+//
+// Both are append-only rings of fixed-size records protected by a CRC-8.
+// Every record goes to the slot after the newest one, so writes are spread
+// evenly over the ring and a record interrupted by a power loss only costs
+// that record, the previous one is still valid. At boot every slot is read
+// and the valid record with the newest sequence number is taken as the head.
+//
+// Records are built in RAM and written one byte per call to log_service by
+// the main loop, a byte is only started once the previous write has
+// finished, so the main loop never waits for the EEPROM. Bytes that already
+// hold the right value are skipped.
+//
+// Counter snapshots are written at most every LOG_COUNTER_PERIOD_MS while
+// the counters change, and right after a fault so the counters that go with
+// it are kept. Counters saturate at 0xFFFF.
+//
+// EEPROM layout, multi-byte fields are little endian:
+//   0x000 - 0x0FF  16 counter records of 16 bytes
+//                  sequence (16-bit), the LOG_xxx counters in order (16-bit
+//                  each), maximum DC/DC temperature, CRC
+//   0x100 - 0x2FF  64 fault records of 8 bytes
+//                  sequence (16-bit), event (trace_event_t), argument
+//                  (16-bit), seconds since boot (16-bit, saturating), CRC
+//   0x300 - 0x3F7  parameter table, see pms_param.h
+//   0x3F8 - 0x3FF  boot record, see pms_boot.h
+//
+// Dump protocol:
+// COMMAND_PMS_LOG_DUMP starts a dump, byte 0 optionally limits the number of
+// faults returned (0 or absent for all of them). The PMS then streams one
+// frame per pass through the idle state on RESPONSE_PMS_LOG_DUMP.
+//
+//   Counters (sequence 0): 0x00, number of faults to follow, boots, BPS
+//                          trips, precharges (16-bit each)
+//   Counters (sequence 1): 0x01, array relay cycles, motor relay cycles,
+//                          faults (16-bit each), maximum DC/DC temperature
+//   Fault    (sequence n): n, event, argument (16-bit), seconds since boot
+//                          (16-bit), record sequence (16-bit), newest first
+//
+// Counters are the live values, faults are the records in the EEPROM, a
+// fault still waiting to be written appears once it is.
+
+#define LOG_EEPROM_SIZE      0x400 // Bytes of data EEPROM
+#define LOG_COUNTER_BASE     0x000 // EEPROM address of the counter ring
+#define LOG_COUNTER_SLOTS       16 // Must be a power of 2
+#define LOG_COUNTER_LEN         16 // Bytes per counter record
+#define LOG_FAULT_BASE       0x100 // EEPROM address of the fault ring
+#define LOG_FAULT_SLOTS         64 // Must be a power of 2
+#define LOG_FAULT_LEN            8 // Bytes per fault record
+#define LOG_QUEUE_DEPTH          4 // Faults waiting to be written, further faults are only counted
+#define LOG_COUNTER_PERIOD_MS 60000 // Minimum time between counter snapshots
+#define LOG_FRAME_LEN            8 // Length of every dump frame
+
+// Lifetime counters, in record order
+typedef enum
+{
+    LOG_BOOTS,         // Resets
+    LOG_BPS_TRIPS,     // BPS trips latched
+    LOG_PRECHARGES,    // Motor precharge cycles
+    LOG_ARRAY_CYCLES,  // MPPT relay closures
+    LOG_MOTOR_CYCLES,  // Motor relay closures
+    LOG_FAULTS,        // Faults logged, including any dropped from a full queue
+    N_LOG_COUNTERS
+} log_counter_t;
+
+void  log_init(void);
+void  log_count(log_counter_t counter);
+void  log_dcdc_temp(int8 temp);
+void  log_fault(trace_event_t event, int16 arg);
+void  log_service(void);
+int16 log_counter(log_counter_t counter);
+void  log_dump_start(int8 max_faults);
+int1  log_dump_pending(void);
+int8  log_dump_frame(int8 * frame);
+int8  crc8(int8 * data, int8 len);
+
+#endif
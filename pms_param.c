@@ -0,0 +1,246 @@
+// Runtime parameters
+// param_get is a table lookup, cheap enough for every use of a parameter
+
+#include "pms_param.h"
+
+static int16       g_param[N_PARAMS];
+static const int16 g_param_default[N_PARAMS] = {PARAM_TABLE(EXPAND_AS_PARAM_DEFAULT)};
+static const int16 g_param_min[N_PARAMS]     = {PARAM_TABLE(EXPAND_AS_PARAM_MIN)};
+static const int16 g_param_max[N_PARAMS]     = {PARAM_TABLE(EXPAND_AS_PARAM_MAX)};
+static int16       g_param_seq;                     // Sequence number of the next copy
+static int8        g_param_copy;                    // Copy (0 or 1) the next save goes to
+static int1        gb_param_dirty;                  // Table changed since the last save
+static int8        g_param_write[PARAM_COPY_SIZE];  // Copy being read or written
+static int8        g_param_write_len;
+static int8        g_param_write_pos;
+
+// Returns true if value is in range for the parameter, keeps the warning and
+// derate thresholds below their critical thresholds and the undervoltage
+// thresholds in falling order
+int1 param_valid(int8 index, int16 value)
+{
+    if ((value < g_param_min[index]) || (value > g_param_max[index]))
+    {
+        return false;
+    }
+    if ((index == PARAM_BPS_TEMP_WARNING) && (value >= g_param[PARAM_BPS_TEMP_CRITICAL]))
+    {
+        return false;
+    }
+    if ((index == PARAM_BPS_TEMP_CRITICAL) && (value <= g_param[PARAM_BPS_TEMP_WARNING]))
+    {
+        return false;
+    }
+    if ((index == PARAM_DCDC_TEMP_DERATE) && (value >= g_param[PARAM_DCDC_TEMP_CRITICAL]))
+    {
+        return false;
+    }
+    if ((index == PARAM_DCDC_TEMP_CRITICAL) && (value <= g_param[PARAM_DCDC_TEMP_DERATE]))
+    {
+        return false;
+    }
+    if ((index == PARAM_AUX_UV_WARNING_MV) && (value <= g_param[PARAM_AUX_UV_SHED_MV]))
+    {
+        return false;
+    }
+    if ((index == PARAM_AUX_UV_SHED_MV) &&
+        ((value >= g_param[PARAM_AUX_UV_WARNING_MV]) || (value <= g_param[PARAM_AUX_UV_CRITICAL_MV])))
+    {
+        return false;
+    }
+    if ((index == PARAM_AUX_UV_CRITICAL_MV) && (value >= g_param[PARAM_AUX_UV_SHED_MV]))
+    {
+        return false;
+    }
+    return true;
+}
+
+// Reads a copy into g_param_write, returns true if it is valid
+// The length comes from the parameter count saved in the copy, so copies
+// saved by a firmware with a different table are still read
+int1 param_read_copy(int8 copy)
+{
+    int16 addr;
+    int8  count;
+
+    addr  = PARAM_BASE + (int16)copy * PARAM_COPY_SIZE;
+    count = read_eeprom(addr + 2);
+    if (count > PARAM_MAX_COUNT)
+    {
+        return false;
+    }
+    return log_read_record(addr,g_param_write,4 + 2 * count);
+}
+
+// Loads the newest valid copy from the EEPROM, or the defaults
+void param_init(void)
+{
+    int8  i;
+    int8  copy;
+    int8  count;
+    int16 seq;
+    int1  b_found;
+
+    for (i = 0 ; i < N_PARAMS ; i++)
+    {
+        g_param[i] = g_param_default[i];
+    }
+    g_param_seq       = 0;
+    g_param_copy      = 0;
+    gb_param_dirty    = false;
+    g_param_write_len = 0;
+    g_param_write_pos = 0;
+
+    copy = 0;
+    b_found = false;
+    for (i = 0 ; i < 2 ; i++)
+    {
+        if (param_read_copy(i) == true)
+        {
+            seq = make16(g_param_write[1],g_param_write[0]);
+            if ((b_found == false) || ((signed int16)(seq - g_param_seq) > 0))
+            {
+                g_param_seq = seq;
+                copy = i;
+                b_found = true;
+            }
+        }
+    }
+    if (b_found == false)
+    {
+        return;
+    }
+
+    // The next save goes to the other copy
+    g_param_seq++;
+    g_param_copy = copy ^ 1;
+    param_read_copy(copy);
+    count = g_param_write[2];
+    for (i = 0 ; (i < count) && (i < N_PARAMS) ; i++)
+    {
+        g_param[i] = make16(g_param_write[4 + 2 * i],g_param_write[3 + 2 * i]);
+    }
+    for (i = 0 ; i < N_PARAMS ; i++)
+    {
+        if (param_valid(i,g_param[i]) == false)
+        {
+            g_param[i] = g_param_default[i];
+        }
+    }
+    if (g_param[PARAM_BPS_TEMP_WARNING] >= g_param[PARAM_BPS_TEMP_CRITICAL])
+    {
+        g_param[PARAM_BPS_TEMP_WARNING]  = g_param_default[PARAM_BPS_TEMP_WARNING];
+        g_param[PARAM_BPS_TEMP_CRITICAL] = g_param_default[PARAM_BPS_TEMP_CRITICAL];
+    }
+    if (g_param[PARAM_DCDC_TEMP_DERATE] >= g_param[PARAM_DCDC_TEMP_CRITICAL])
+    {
+        g_param[PARAM_DCDC_TEMP_DERATE]   = g_param_default[PARAM_DCDC_TEMP_DERATE];
+        g_param[PARAM_DCDC_TEMP_CRITICAL] = g_param_default[PARAM_DCDC_TEMP_CRITICAL];
+    }
+    if ((g_param[PARAM_AUX_UV_WARNING_MV] <= g_param[PARAM_AUX_UV_SHED_MV]) ||
+        (g_param[PARAM_AUX_UV_SHED_MV] <= g_param[PARAM_AUX_UV_CRITICAL_MV]))
+    {
+        g_param[PARAM_AUX_UV_WARNING_MV]  = g_param_default[PARAM_AUX_UV_WARNING_MV];
+        g_param[PARAM_AUX_UV_SHED_MV]     = g_param_default[PARAM_AUX_UV_SHED_MV];
+        g_param[PARAM_AUX_UV_CRITICAL_MV] = g_param_default[PARAM_AUX_UV_CRITICAL_MV];
+    }
+}
+
+int16 param_get(param_t param)
+{
+    return g_param[param];
+}
+
+// Stores a value in RAM, it is used from then on and saved in the background
+// Returns one of the PMS_PARAM_xxx codes
+int8 param_set(int8 index, int16 value)
+{
+    if (index >= N_PARAMS)
+    {
+        return PMS_PARAM_BAD_INDEX;
+    }
+    if (param_valid(index,value) == false)
+    {
+        return PMS_PARAM_OUT_OF_RANGE;
+    }
+
+    // The timer interrupt reads the sending periods, mask it so it never sees
+    // a half-updated value
+    disable_interrupts(INT_TIMER2);
+    g_param[index] = value;
+    enable_interrupts(INT_TIMER2);
+    gb_param_dirty = true;
+    return PMS_PARAM_OK;
+}
+
+void param_defaults(void)
+{
+    int8 i;
+
+    disable_interrupts(INT_TIMER2);
+    for (i = 0 ; i < N_PARAMS ; i++)
+    {
+        g_param[i] = g_param_default[i];
+    }
+    enable_interrupts(INT_TIMER2);
+    gb_param_dirty = true;
+}
+
+int16 param_min(int8 index)
+{
+    return g_param_min[index];
+}
+
+int16 param_max(int8 index)
+{
+    return g_param_max[index];
+}
+
+// Background writer, called on every pass through the idle state
+// Starts at most one EEPROM byte write and returns without waiting for it
+void param_service(void)
+{
+    int8  i;
+    int16 addr;
+
+    if (EECON1_WR == 1)
+    {
+        return;
+    }
+
+    if (g_param_write_pos < g_param_write_len)
+    {
+        addr = PARAM_BASE + (int16)g_param_copy * PARAM_COPY_SIZE + g_param_write_pos;
+        if (read_eeprom(addr) != g_param_write[g_param_write_pos])
+        {
+            write_eeprom(addr,g_param_write[g_param_write_pos]);
+        }
+        g_param_write_pos++;
+        return;
+    }
+
+    if (g_param_write_len > 0)
+    {
+        // The copy is complete, the next save goes to the other one
+        g_param_seq++;
+        g_param_copy ^= 1;
+        g_param_write_len = 0;
+        g_param_write_pos = 0;
+    }
+
+    if (gb_param_dirty == true)
+    {
+        // Changes made while a copy is being written are saved in the next one
+        g_param_write[0] = make8(g_param_seq,0);
+        g_param_write[1] = make8(g_param_seq,1);
+        g_param_write[2] = N_PARAMS;
+        for (i = 0 ; i < N_PARAMS ; i++)
+        {
+            g_param_write[3 + 2 * i] = make8(g_param[i],0);
+            g_param_write[4 + 2 * i] = make8(g_param[i],1);
+        }
+        g_param_write[PARAM_RECORD_LEN - 1] = crc8(g_param_write,PARAM_RECORD_LEN - 1);
+        g_param_write_len = PARAM_RECORD_LEN;
+        gb_param_dirty = false;
+    }
+}
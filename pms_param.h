@@ -0,0 +1,103 @@
+#ifndef PMS_PARAM_H
+#define PMS_PARAM_H
+
+#include "pms_temp.h"
+#include "pms_dcdc.h"
+#include "pms_aux.h"
+
+// Runtime parameters
+// Timing periods, temperature thresholds and calibrations that can be tuned over CAN bus
+// without reflashing. The values live in RAM and take effect on their next
+// use, every change is also saved to the data EEPROM in the background and
+// loaded again at boot.
+//
+// The table is saved as two copies that are written alternately, each one a
+// sequence number, the number of parameters, the values and a CRC-8. At boot
+// the valid copy with the newest sequence number is loaded, values that are
+// missing or outside their range fall back to the default, so an interrupted
+// save or a firmware with more parameters still boots with sane values.
+//
+// Parameter protocol:
+// COMMAND_PMS_PARAM
+//   Byte 0: operation, one of the PMS_PARAM_OP_xxx codes
+//   Byte 1: parameter index (param_t)
+//   Bytes 2-3: new value for PMS_PARAM_OP_WRITE, little endian
+//   Bytes 4-5: PMS_PARAM_KEY for PMS_PARAM_OP_WRITE and PMS_PARAM_OP_DEFAULTS
+// RESPONSE_PMS_PARAM
+//   Byte 0: result, one of the PMS_PARAM_xxx codes
+//   Byte 1: parameter index
+//   Bytes 2-3: current value
+//   Bytes 4-5: minimum value
+//   Bytes 6-7: maximum value
+// Reading the indices in turn until PMS_PARAM_BAD_INDEX lists the table.
+
+// Defaults
+#define SENDING_PERIOD_MS     1000 // Telemetry data is sent over CAN bus at this period
+#define FAULT_SENDING_PERIOD_MS 250 // Telemetry period while a fault is active
+#define PRECHARGE_DURATION_MS 2000 // Timed precharge, used when the precharge sense cannot be trusted
+#define PRECHARGE_LIMIT_MS    7000 // CANNOT PRECHARGE FOR MORE THAN 7 SECONDS, hard ceiling of every precharge
+#define PRECHARGE_PERCENT       95 // The bus must reach this percentage of the pack voltage
+#define HORN_DURATION_MS       500 // Duration of the horn honk
+#define DEBOUNCE_PERIOD_MS      10 // Hardware switch debounce period
+#define RELAY_PULL_IN_MS       100 // Full coil voltage after a relay closes
+#define RELAY_HOLD_DUTY         60 // Coil PWM duty in percent once the relay has pulled in
+#define AUX_GAIN_UV           4883 // Aux input microvolts per ADC count, 5V reference and a 4:1 divider
+#define AUX_ZERO                 0 // Aux input ADC reading at 0V
+#define AUX_DIFFERENTIAL         1 // The aux inputs are cumulative taps, report each cell
+
+// X macro table of runtime parameters
+//        Parameter                     , Default                , Min , Max
+// The aux gains, zeros and undervoltage thresholds must stay in order, see pms_aux.c
+#define PARAM_TABLE(ENTRY)                                                                   \
+    ENTRY(PARAM_SENDING_PERIOD_MS       , SENDING_PERIOD_MS      ,  100, 10000)              \
+    ENTRY(PARAM_FAULT_SENDING_PERIOD_MS , FAULT_SENDING_PERIOD_MS,   50, 10000)              \
+    ENTRY(PARAM_PRECHARGE_DURATION_MS   , PRECHARGE_DURATION_MS  ,  500, PRECHARGE_LIMIT_MS) \
+    ENTRY(PARAM_PRECHARGE_PERCENT       , PRECHARGE_PERCENT      ,   50,    99)              \
+    ENTRY(PARAM_HORN_DURATION_MS        , HORN_DURATION_MS       ,    0,  2000)              \
+    ENTRY(PARAM_DEBOUNCE_PERIOD_MS      , DEBOUNCE_PERIOD_MS     ,    1,   100)              \
+    ENTRY(PARAM_BPS_TEMP_WARNING        , BPS_TEMP_WARNING       ,   20,    60)              \
+    ENTRY(PARAM_BPS_TEMP_CRITICAL       , BPS_TEMP_CRITICAL      ,   30,    70)              \
+    ENTRY(PARAM_RELAY_PULL_IN_MS        , RELAY_PULL_IN_MS       ,   20,  1000)              \
+    ENTRY(PARAM_RELAY_HOLD_DUTY         , RELAY_HOLD_DUTY        ,   30,   100)              \
+    ENTRY(PARAM_AUX1_GAIN_UV            , AUX_GAIN_UV            , 1000, 15000)              \
+    ENTRY(PARAM_AUX2_GAIN_UV            , AUX_GAIN_UV            , 1000, 15000)              \
+    ENTRY(PARAM_AUX3_GAIN_UV            , AUX_GAIN_UV            , 1000, 15000)              \
+    ENTRY(PARAM_AUX4_GAIN_UV            , AUX_GAIN_UV            , 1000, 15000)              \
+    ENTRY(PARAM_AUX1_ZERO               , AUX_ZERO               ,    0,   400)              \
+    ENTRY(PARAM_AUX2_ZERO               , AUX_ZERO               ,    0,   400)              \
+    ENTRY(PARAM_AUX3_ZERO               , AUX_ZERO               ,    0,   400)              \
+    ENTRY(PARAM_AUX4_ZERO               , AUX_ZERO               ,    0,   400)              \
+    ENTRY(PARAM_AUX_DIFFERENTIAL        , AUX_DIFFERENTIAL       ,    0,     1)              \
+    ENTRY(PARAM_DCDC_TEMP_DERATE        , DCDC_TEMP_DERATE       ,   50,   120)              \
+    ENTRY(PARAM_DCDC_TEMP_CRITICAL      , DCDC_TEMP_CRITICAL     ,   60,   130)              \
+    ENTRY(PARAM_AUX_UV_WARNING_MV       , AUX_UV_WARNING_MV      , 2800,  4000)              \
+    ENTRY(PARAM_AUX_UV_SHED_MV          , AUX_UV_SHED_MV         , 2800,  4000)              \
+    ENTRY(PARAM_AUX_UV_CRITICAL_MV      , AUX_UV_CRITICAL_MV     , 2800,  4000)              \
+    ENTRY(PARAM_BPS_TEMP_RISE_LIMIT     , BPS_TEMP_RISE_LIMIT    ,    1,    20)              \
+    ENTRY(PARAM_BPS_TEMP_RISE_WINDOW_MS , BPS_TEMP_RISE_WINDOW_MS, 1000, 60000)
+
+#define EXPAND_AS_PARAM_ENUM(a,b,c,d)    a,
+#define EXPAND_AS_PARAM_DEFAULT(a,b,c,d) b,
+#define EXPAND_AS_PARAM_MIN(a,b,c,d)     c,
+#define EXPAND_AS_PARAM_MAX(a,b,c,d)     d,
+
+typedef enum
+{
+    PARAM_TABLE(EXPAND_AS_PARAM_ENUM)
+    N_PARAMS
+} param_t;
+
+#define PARAM_BASE          0x300 // EEPROM address of the first copy
+#define PARAM_COPY_SIZE        64 // Space reserved for each copy
+#define PARAM_MAX_COUNT     ((PARAM_COPY_SIZE - 4) / 2) // Most parameters a copy can hold
+#define PARAM_RECORD_LEN    (4 + 2 * N_PARAMS) // Sequence, count, values, CRC
+
+void  param_init(void);
+int16 param_get(param_t param);
+int8  param_set(int8 index, int16 value);
+void  param_defaults(void);
+void  param_service(void);
+int16 param_min(int8 index);
+int16 param_max(int8 index);
+
+#endif
@@ -0,0 +1,220 @@
+// Relay scheduler
+// The queue is written by the main loop and read by isr_timer2, the main
+// loop masks the timer interrupt while it changes the queue
+
+#include "pms_relay.h"
+
+typedef struct
+{
+    int8 relay; // relay_t
+    int1 level;
+} relay_request_t;
+
+static relay_request_t g_relay_queue[RELAY_QUEUE_DEPTH];
+static int8            g_relay_head;    // Next request to be carried out
+static int8            g_relay_tail;    // Next free entry
+static int8            g_relay_wait_ms; // Time left before the next request may be carried out
+static int8            g_relay_duty[N_RELAYS]; // Coil duty in percent
+static int16           g_relay_pull_in_ms;     // Time left at full duty for the motor relay
+static int8            g_relay_hold_limit;     // Highest hold duty allowed, 100 for no limit
+
+// Drives every relay output low, called first thing after a reset so no
+// coil is left floating while the PMS starts up
+void relay_safe(void)
+{
+    output_low(MPPT_PIN);
+    output_low(MOTOR_PIN);
+    output_low(PRECHARGE_PIN);
+    output_low(HORN_PIN);
+    output_low(AUX_READ_PIN);
+}
+
+void relay_init(void)
+{
+    int8 i;
+
+    g_relay_head       = 0;
+    g_relay_tail       = 0;
+    g_relay_wait_ms    = 0;
+    g_relay_pull_in_ms = 0;
+    g_relay_hold_limit = 100;
+    for (i = 0 ; i < N_RELAYS ; i++)
+    {
+        g_relay_duty[i] = 0;
+    }
+    
+    // Motor relay coil on the CCP2 PWM, off to start with
+    output_low(MOTOR_PIN);
+    setup_ccp2(CCP_PWM);
+    set_pwm2_duty((int16)0);
+}
+
+// Drives a relay pin, inlined so the tick and relay_open do not share a call
+#inline
+void relay_drive(int8 relay, int1 level)
+{
+    g_relay_duty[relay] = level ? 100 : 0;
+    switch(relay)
+    {
+        case RELAY_MPPT:
+            output_bit(MPPT_PIN,level);
+            break;
+        case RELAY_MOTOR:
+            // Full duty to pull in, relay_tick drops it to the hold duty
+            if (level == 1)
+            {
+                set_pwm2_duty((int16)RELAY_PWM_FULL);
+                g_relay_pull_in_ms = g_param[PARAM_RELAY_PULL_IN_MS];
+            }
+            else
+            {
+                set_pwm2_duty((int16)0);
+                g_relay_pull_in_ms = 0;
+            }
+            break;
+        case RELAY_PRECHARGE:
+            output_bit(PRECHARGE_PIN,level);
+            break;
+        case RELAY_HORN:
+            output_bit(HORN_PIN,level);
+            break;
+        default:
+            break;
+    }
+}
+
+// Drops the motor relay to its hold duty, inlined for the same reason
+#inline
+void relay_hold(void)
+{
+    g_relay_duty[RELAY_MOTOR] = g_param[PARAM_RELAY_HOLD_DUTY];
+    if (g_relay_duty[RELAY_MOTOR] > g_relay_hold_limit)
+    {
+        g_relay_duty[RELAY_MOTOR] = g_relay_hold_limit;
+    }
+    set_pwm2_duty((int16)(((int32)RELAY_PWM_FULL * g_relay_duty[RELAY_MOTOR]) / 100));
+}
+
+// Returns the queue entry waiting for a relay, or RELAY_QUEUE_DEPTH
+int8 relay_find(relay_t relay)
+{
+    int8 i;
+
+    for (i = g_relay_head ; i != g_relay_tail ; i = (i + 1) & RELAY_QUEUE_MASK)
+    {
+        if (g_relay_queue[i].relay == relay)
+        {
+            return i;
+        }
+    }
+    return RELAY_QUEUE_DEPTH;
+}
+
+// Queues a relay change behind the requests already waiting
+void relay_queue(relay_t relay, int1 level)
+{
+    int8 i;
+
+    disable_interrupts(INT_TIMER2);
+    i = relay_find(relay);
+    if (i == RELAY_QUEUE_DEPTH)
+    {
+        // Cannot overflow, each relay has at most one entry
+        i = g_relay_tail;
+        g_relay_queue[i].relay = relay;
+        g_relay_tail = (g_relay_tail + 1) & RELAY_QUEUE_MASK;
+    }
+    g_relay_queue[i].level = level;
+    enable_interrupts(INT_TIMER2);
+}
+
+void relay_close(relay_t relay)
+{
+    relay_queue(relay,1);
+}
+
+// Opens a relay straight away
+void relay_open(relay_t relay)
+{
+    int8 i;
+
+    disable_interrupts(INT_TIMER2);
+    i = relay_find(relay);
+    if (i != RELAY_QUEUE_DEPTH)
+    {
+        // Drop the waiting request, the ones behind it move up
+        while (((i + 1) & RELAY_QUEUE_MASK) != g_relay_tail)
+        {
+            g_relay_queue[i] = g_relay_queue[(i + 1) & RELAY_QUEUE_MASK];
+            i = (i + 1) & RELAY_QUEUE_MASK;
+        }
+        g_relay_tail = i;
+    }
+    relay_drive(relay,0);
+    enable_interrupts(INT_TIMER2);
+}
+
+// Returns true while a request for the relay is waiting
+int1 relay_pending(relay_t relay)
+{
+    int8 i;
+
+    disable_interrupts(INT_TIMER2);
+    i = relay_find(relay);
+    enable_interrupts(INT_TIMER2);
+    return (i != RELAY_QUEUE_DEPTH);
+}
+
+// Caps the motor relay hold duty, 100 removes the cap
+// A held relay changes straight away, one pulling in at the end of its pull-in
+void relay_limit_hold(int8 duty)
+{
+    disable_interrupts(INT_TIMER2);
+    g_relay_hold_limit = duty;
+    if ((g_relay_duty[RELAY_MOTOR] != 0) && (g_relay_pull_in_ms == 0))
+    {
+        relay_hold();
+    }
+    enable_interrupts(INT_TIMER2);
+}
+
+// Returns the duty in percent a relay coil is driven at, 0 when open
+int8 relay_duty(relay_t relay)
+{
+    return g_relay_duty[relay];
+}
+
+// Carries out the next request once the previous coil has settled, and
+// drops the motor relay to its hold duty at the end of the pull-in
+// Called by isr_timer2 every 1ms, so parameters are read from g_param directly
+void relay_tick(void)
+{
+    relay_request_t * request;
+    
+    if (g_relay_pull_in_ms > 0)
+    {
+        g_relay_pull_in_ms--;
+        if (g_relay_pull_in_ms == 0)
+        {
+            relay_hold();
+        }
+    }
+
+    if (g_relay_wait_ms > 0)
+    {
+        g_relay_wait_ms--;
+        return;
+    }
+
+    if (g_relay_head != g_relay_tail)
+    {
+        request = &g_relay_queue[g_relay_head];
+        relay_drive(request->relay,request->level);
+        if (request->level == 1)
+        {
+            // Only an energised coil draws inrush current
+            g_relay_wait_ms = RELAY_SPACING_MS - 1;
+        }
+        g_relay_head = (g_relay_head + 1) & RELAY_QUEUE_MASK;
+    }
+}
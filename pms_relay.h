@@ -0,0 +1,50 @@
+#ifndef PMS_RELAY_H
+#define PMS_RELAY_H
+
+// Relay scheduler
+// Relay coils are energised from the timer tick, one at a time and at least
+// RELAY_SPACING_MS apart, so several switch events in the same instant never
+// pull the inrush current of more than one coil from the aux pack.
+//
+// relay_close and relay_queue add a request to a FIFO that isr_timer2 works
+// through, a relay has at most one request waiting, a newer request for it
+// replaces the level of the waiting one. relay_open de-energises a coil at
+// once and drops its waiting request, opening is never delayed since it is
+// how faults are handled and it only reduces the load on the aux pack.
+// Queueing an open instead keeps it behind the requests already waiting,
+// which gives make-before-break ordering, eg the precharge relay opening
+// after the motor relay has closed.
+//
+// Coil economiser: the motor relay is driven by the CCP2 PWM on RC2, at full
+// duty for PARAM_RELAY_PULL_IN_MS after it closes and at
+// PARAM_RELAY_HOLD_DUTY from then on, which cuts the holding power drawn
+// from the aux pack. The PWM runs from timer2 (CLOCK_T2_PR2) at about 16kHz. The
+// MPPT relay on RC3 has no CCP module behind it and is held at full voltage.
+// A change of the hold duty applies from the next pull-in. relay_limit_hold
+// caps the hold duty to shed load, that applies straight away.
+
+#define RELAY_SPACING_MS    25 // Minimum time between coil energisations, covers the inrush of one coil
+#define RELAY_QUEUE_DEPTH    8 // One request per relay, must be a power of 2 larger than N_RELAYS
+#define RELAY_QUEUE_MASK    (RELAY_QUEUE_DEPTH - 1)
+#define RELAY_PWM_FULL     (4 * (CLOCK_T2_PR2 + 1)) // CCP 10-bit duty for 100%
+
+typedef enum
+{
+    RELAY_MPPT,      // MPPT_PIN, array contactor
+    RELAY_MOTOR,     // MOTOR_PIN, motor contactor
+    RELAY_PRECHARGE, // PRECHARGE_PIN, motor controller precharge
+    RELAY_HORN,      // HORN_PIN
+    N_RELAYS
+} relay_t;
+
+void relay_safe(void);
+void relay_init(void);
+void relay_queue(relay_t relay, int1 level);
+void relay_close(relay_t relay);
+void relay_open(relay_t relay);
+int1 relay_pending(relay_t relay);
+int8 relay_duty(relay_t relay);
+void relay_limit_hold(int8 duty);
+void relay_tick(void);
+
+#endif
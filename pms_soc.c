@@ -0,0 +1,182 @@
+// Aux pack state of charge
+// soc_update takes at most a few hundred cycles, called every AUX_SAMPLE_PERIOD_MS
+
+#include "pms_soc.h"
+
+// Open circuit voltage of a Li-ion cell at 0%, 10%, ... 100% state of charge, mV
+static const int16 g_soc_ocv_mv[SOC_OCV_POINTS] = {3000, 3450, 3550, 3610, 3650, 3700,
+                                                   3760, 3840, 3920, 4020, 4180};
+static int16 g_soc_ocv_slope[SOC_OCV_POINTS - 1]; // 0.01% per mV of each segment, 8.8 fixed point
+static int32 g_soc_filter[N_AUX_CELLS];           // Filtered cell voltages, mV << 4
+static int16 g_soc_min_mv;
+static int16 g_soc_max_mv;
+static int8  g_soc_min_cell;
+static int8  g_soc_max_cell;
+static int16 g_soc;                               // Estimate, 0.01%
+static int8  g_soc_flags;
+static int16 g_soc_ref_mv;                        // Lowest cell at the start of the rest window
+static int32 g_soc_ref_ms;                        // Tick the rest window started
+static int1  gb_soc_moved;                        // The lowest cell left the rest band this window
+
+void soc_init(void)
+{
+    int8 i;
+
+    // The only divisions, done once
+    for (i = 0 ; i < (SOC_OCV_POINTS - 1) ; i++)
+    {
+        g_soc_ocv_slope[i] = ((int32)(SOC_FULL / (SOC_OCV_POINTS - 1)) << 8) /
+                             (g_soc_ocv_mv[i + 1] - g_soc_ocv_mv[i]);
+    }
+    g_soc_min_mv   = 0;
+    g_soc_max_mv   = 0;
+    g_soc_min_cell = 0;
+    g_soc_max_cell = 0;
+    g_soc          = 0;
+    g_soc_flags    = 0;
+    gb_soc_moved   = false;
+}
+
+// Returns the state of charge in 0.01% at a cell open circuit voltage
+int16 soc_lookup(int16 mv)
+{
+    int8 i;
+
+    if (mv <= g_soc_ocv_mv[0])
+    {
+        return 0;
+    }
+    for (i = 1 ; i < SOC_OCV_POINTS ; i++)
+    {
+        if (mv < g_soc_ocv_mv[i])
+        {
+            return (int16)(i - 1) * (SOC_FULL / (SOC_OCV_POINTS - 1)) +
+                   (int16)(((int32)(mv - g_soc_ocv_mv[i - 1]) * g_soc_ocv_slope[i - 1]) >> 8);
+        }
+    }
+    return SOC_FULL;
+}
+
+// Takes a sample of the cell voltages at tick now
+void soc_update(int16 * cell_mv, int32 now)
+{
+    int8  i;
+    int16 mv;
+    int16 target;
+    int32 sample;
+
+    // Filter each cell and find the lowest and highest
+    for (i = 0 ; i < N_AUX_CELLS ; i++)
+    {
+        sample = (int32)cell_mv[i] << 4;
+        if ((g_soc_flags & SOC_FLAG_VALID) == 0)
+        {
+            g_soc_filter[i] = sample;
+        }
+        else if (sample > g_soc_filter[i])
+        {
+            g_soc_filter[i] += (sample - g_soc_filter[i]) >> SOC_FILTER_SHIFT;
+        }
+        else
+        {
+            g_soc_filter[i] -= (g_soc_filter[i] - sample) >> SOC_FILTER_SHIFT;
+        }
+
+        mv = g_soc_filter[i] >> 4;
+        if ((i == 0) || (mv < g_soc_min_mv))
+        {
+            g_soc_min_mv   = mv;
+            g_soc_min_cell = i;
+        }
+        if ((i == 0) || (mv > g_soc_max_mv))
+        {
+            g_soc_max_mv   = mv;
+            g_soc_max_cell = i;
+        }
+    }
+
+    target = soc_lookup(g_soc_min_mv);
+    if ((g_soc_flags & SOC_FLAG_VALID) == 0)
+    {
+        // First sample, start from the OCV and a new rest window
+        g_soc        = target;
+        g_soc_flags  = SOC_FLAG_VALID;
+        g_soc_ref_mv = g_soc_min_mv;
+        g_soc_ref_ms = now;
+        gb_soc_moved = false;
+        return;
+    }
+
+    // Rest detection, the lowest cell must stay in the band for a whole window
+    if ((g_soc_min_mv > (g_soc_ref_mv + SOC_REST_BAND_MV)) ||
+        ((g_soc_min_mv + SOC_REST_BAND_MV) < g_soc_ref_mv))
+    {
+        gb_soc_moved = true;
+        g_soc_flags &= ~SOC_FLAG_AT_REST;
+    }
+    if ((now - g_soc_ref_ms) >= SOC_REST_WINDOW_MS)
+    {
+        if (gb_soc_moved == false)
+        {
+            g_soc_flags |= SOC_FLAG_AT_REST;
+        }
+        g_soc_ref_mv = g_soc_min_mv;
+        g_soc_ref_ms = now;
+        gb_soc_moved = false;
+    }
+
+    if ((g_soc_flags & SOC_FLAG_AT_REST) != 0)
+    {
+        g_soc = target;
+    }
+    else if (target > (g_soc + SOC_SLEW))
+    {
+        g_soc += SOC_SLEW;
+    }
+    else if ((target + SOC_SLEW) < g_soc)
+    {
+        g_soc -= SOC_SLEW;
+    }
+    else
+    {
+        g_soc = target;
+    }
+}
+
+// Returns the filtered voltage of a cell in mV
+int16 soc_cell(int8 cell)
+{
+    return g_soc_filter[cell] >> 4;
+}
+
+int16 soc_min_mv(void)
+{
+    return g_soc_min_mv;
+}
+
+int16 soc_max_mv(void)
+{
+    return g_soc_max_mv;
+}
+
+int8 soc_min_cell(void)
+{
+    return g_soc_min_cell;
+}
+
+int8 soc_max_cell(void)
+{
+    return g_soc_max_cell;
+}
+
+// Returns the estimated state of charge in 0.01%
+int16 soc_percent(void)
+{
+    return g_soc;
+}
+
+// Returns the SOC_FLAG_xxx bits
+int8 soc_flags(void)
+{
+    return g_soc_flags;
+}
@@ -0,0 +1,50 @@
+#ifndef PMS_SOC_H
+#define PMS_SOC_H
+
+// Aux pack state of charge
+// Estimates the state of charge of the aux pack from its cell voltages alone,
+// there is no current sensor to count coulombs with.
+//
+// soc_update is given the cell voltages every AUX_SAMPLE_PERIOD_MS. Each cell
+// is smoothed by an exponential filter, 1/2^SOC_FILTER_SHIFT of the way to
+// each new reading, and the filtered voltages give the minimum, maximum and
+// spread of the cells.
+//
+// The lowest cell limits the pack, its filtered voltage is looked up in the
+// open circuit voltage (OCV) table of the cells to get a target state of
+// charge. A cell voltage only matches the OCV once the pack has rested, so
+// the pack is taken to be at rest when the lowest cell has moved less than
+// SOC_REST_BAND_MV over a whole SOC_REST_WINDOW_MS. At rest the estimate is
+// set to the target, under load it moves towards the target by at most
+// SOC_SLEW per sample, so a sag when a load switches on does not pull it
+// down but a steady fall does. The first sample sets the estimate.
+//
+// The state of charge is kept in 0.01%. Everything is integer math, the OCV
+// lookup interpolates with slopes computed once by soc_init.
+//
+// The statistics assume each value is one cell, ie PARAM_AUX_DIFFERENTIAL on
+// the cumulative tap inputs.
+
+#define AUX_SAMPLE_PERIOD_MS    100 // The aux pack is read this often
+#define SOC_FILTER_SHIFT          3 // Filter time constant of 2^SOC_FILTER_SHIFT samples
+#define SOC_REST_BAND_MV          5 // Largest move of the lowest cell in a window at rest
+#define SOC_REST_WINDOW_MS    30000 // Length of the rest detection window
+#define SOC_SLEW                  1 // Largest change per sample under load, 0.01%
+#define SOC_FULL              10000 // 100% in 0.01%
+#define SOC_OCV_POINTS           11 // OCV table entries, 0% to 100% in 10% steps
+
+// soc_flags bits
+#define SOC_FLAG_VALID         0x01 // At least one sample taken
+#define SOC_FLAG_AT_REST       0x02 // The estimate is the OCV of the lowest cell
+
+void  soc_init(void);
+void  soc_update(int16 * cell_mv, int32 now);
+int16 soc_cell(int8 cell);
+int16 soc_min_mv(void);
+int16 soc_max_mv(void);
+int8  soc_min_cell(void);
+int8  soc_max_cell(void);
+int16 soc_percent(void);
+int8  soc_flags(void);
+
+#endif
@@ -0,0 +1,295 @@
+// Battery temperature supervisor
+// temp_update is called for every BPS temperature frame and temp_check
+// whenever the array decision is needed, both take constant time
+
+#include "pms_temp.h"
+
+static int8  g_temp_page_max[TEMP_N_PAGES];  // Hottest cell of each page
+static int8  g_temp_page_cell[TEMP_N_PAGES]; // Index of that cell within the page
+static int32 g_temp_page_ms[TEMP_N_PAGES];   // Tick each page was last received
+static int8  g_temp_page_rise[TEMP_N_PAGES]; // Rise since the start of the window
+static int8  g_temp_ref_max[TEMP_N_PAGES];   // Reading at the start of the window
+static int32 g_temp_ref_ms[TEMP_N_PAGES];    // Tick the window started
+static int8  g_temp_seen;                    // Bit per page received since reset
+static int8  g_temp_warm;                    // Bit per page inside the hysteresis band or hotter
+static int8  g_temp_rising;                  // Bit per page heating faster than the rise limit
+static int8  g_temp_hot;                     // Bit per page at or over the warning threshold
+static int8  g_temp_critical;                // Bit per page over the critical threshold, with hysteresis
+static int8  g_temp_fault_page;              // Page (1-3) behind the last verdict other than SAFE or HOLD
+
+void temp_init(void)
+{
+    g_temp_seen       = 0;
+    g_temp_warm       = 0;
+    g_temp_rising     = 0;
+    g_temp_hot        = 0;
+    g_temp_critical   = 0;
+    g_temp_fault_page = 1;
+}
+
+#ifdef __PCH__
+
+// One step of the unrolled PIC18 scan, a compare and a conditional skip, see
+// pms_temp.h for why it is not branch-free
+#define TEMP_SCAN_CELL(n)       \
+    if (data[n] > max)          \
+    {                           \
+        max = data[n];          \
+        hottest = n;            \
+    }
+
+// Returns the hottest reading of a page and stores its index in cell
+// Full pages are scanned without a loop counter, the earliest cell wins a tie
+int8 temp_scan(int8 * data, int8 len, int8 * cell)
+{
+    int8 i;
+    int8 max;
+    int8 hottest;
+
+    max = 0;
+    hottest = 0;
+    if (len == 8)
+    {
+        TEMP_SCAN_CELL(0);
+        TEMP_SCAN_CELL(1);
+        TEMP_SCAN_CELL(2);
+        TEMP_SCAN_CELL(3);
+        TEMP_SCAN_CELL(4);
+        TEMP_SCAN_CELL(5);
+        TEMP_SCAN_CELL(6);
+        TEMP_SCAN_CELL(7);
+    }
+    else
+    {
+        for (i = 0 ; i < len ; i++)
+        {
+            TEMP_SCAN_CELL(i);
+        }
+    }
+    
+    *cell = hottest;
+    return max;
+}
+
+#else
+
+// Host and ARM builds (little endian) scan the page as one 64-bit word (SIMD
+// within a register), the earliest cell wins a tie
+#define TEMP_SWAR_LO 0x0101010101010101ULL
+#define TEMP_SWAR_HI 0x8080808080808080ULL
+#define TEMP_SWAR_16 0x00FF00FF00FF00FFULL
+#define TEMP_SWAR_G  0x0100010001000100ULL
+
+// Lane-wise maximum of two words of 16-bit lanes holding 8-bit values
+static uint64_t temp_swar_max16(uint64_t a, uint64_t b)
+{
+    // Bit 8 of each lane of (a + 0x100) - b is set where a >= b
+    uint64_t ge = ((((a | TEMP_SWAR_G) - b) >> 8) & (TEMP_SWAR_LO & TEMP_SWAR_16)) * 0xFF;
+    return b ^ ((a ^ b) & ge);
+}
+
+int8 temp_scan(int8 * data, int8 len, int8 * cell)
+{
+    uint64_t page = 0;
+    uint64_t max;
+    uint64_t miss;
+    int8 i;
+
+    if (len >= 8)
+    {
+        memcpy(&page, data, 8);
+    }
+    else
+    {
+        // Short pages are padded with cold cells
+        for (i = 0 ; i < len ; i++)
+        {
+            page |= (uint64_t)data[i] << (8 * i);
+        }
+    }
+
+    // Pairwise maximum, 8 bytes to 4 lanes to 2 to 1
+    max = temp_swar_max16(page & TEMP_SWAR_16, (page >> 8) & TEMP_SWAR_16);
+    max = temp_swar_max16(max, max >> 16);
+    max = temp_swar_max16(max, max >> 32) & 0xFF;
+
+    // Lowest byte equal to the maximum, found as the first zero byte of
+    // page ^ max. Only the lowest flagged byte is exact, which is the one used.
+    miss = page ^ (max * TEMP_SWAR_LO);
+    *cell = (int8)(__builtin_ctzll((miss - TEMP_SWAR_LO) & ~miss & TEMP_SWAR_HI) >> 3);
+    return (int8)max;
+}
+
+#endif
+
+// Records a BPS temperature page, page is 0 for CAN_BPS_TEMPERATURE1
+void temp_update(int8 page, int8 * data, int8 len, int32 now)
+{
+    int8  max;
+    int8  cell;
+    int8  bit;
+    int8  rise;
+    int8  warning;
+    int8  critical;
+    int8  rise_limit;
+
+    if ((page >= TEMP_N_PAGES) || (len < TEMP_PAGE_LEN))
+    {
+        // Not a whole page, it must not count as a fresh reading
+        return;
+    }
+
+    max = temp_scan(data,len,&cell);
+    bit = 1 << page;
+
+    if ((g_temp_seen & bit) == 0)
+    {
+        // First reading of this page starts its rise window
+        g_temp_ref_max[page] = max;
+        g_temp_ref_ms[page]  = now;
+        g_temp_seen |= bit;
+    }
+
+    g_temp_page_max[page]  = max;
+    g_temp_page_cell[page] = cell;
+    g_temp_page_ms[page]   = now;
+
+    // Rate of rise, flagged as soon as the limit is reached within a window
+    // and cleared when a whole window ends below it, the limit and the window
+    // are runtime parameters
+    rise = 0;
+    if (max > g_temp_ref_max[page])
+    {
+        rise = max - g_temp_ref_max[page];
+    }
+    g_temp_page_rise[page] = rise;
+    rise_limit = param_get(PARAM_BPS_TEMP_RISE_LIMIT);
+    if (rise >= rise_limit)
+    {
+        g_temp_rising |= bit;
+    }
+    if ((now - g_temp_ref_ms[page]) >= param_get(PARAM_BPS_TEMP_RISE_WINDOW_MS))
+    {
+        if (rise < rise_limit)
+        {
+            g_temp_rising &= ~bit;
+        }
+        g_temp_ref_max[page] = max;
+        g_temp_ref_ms[page]  = now;
+    }
+
+    // Threshold masks, the thresholds are runtime parameters
+    warning  = param_get(PARAM_BPS_TEMP_WARNING);
+    critical = param_get(PARAM_BPS_TEMP_CRITICAL);
+    if (max >= (warning - BPS_TEMP_HYSTERESIS))
+    {
+        g_temp_warm |= bit;
+    }
+    else
+    {
+        g_temp_warm &= ~bit;
+    }
+
+    if (max >= warning)
+    {
+        g_temp_hot |= bit;
+    }
+    else
+    {
+        g_temp_hot &= ~bit;
+    }
+
+    if (max >= critical)
+    {
+        g_temp_critical |= bit;
+    }
+    else if (max < (critical - BPS_TEMP_HYSTERESIS))
+    {
+        g_temp_critical &= ~bit;
+    }
+}
+
+// Records the lowest page of a fault mask as the fault page
+void temp_set_fault(int8 mask)
+{
+    int8 i;
+
+    for (i = 0 ; i < TEMP_N_PAGES ; i++)
+    {
+        if (bit_test(mask,i))
+        {
+            g_temp_fault_page = i + 1;
+            return;
+        }
+    }
+}
+
+// Returns the verdict for the whole pack at tick now
+temp_status_t temp_check(int32 now)
+{
+    int8 i;
+    int8 stale;
+
+    if (g_temp_critical != 0)
+    {
+        temp_set_fault(g_temp_critical);
+        return TEMP_CRITICAL;
+    }
+
+    if (g_temp_hot != 0)
+    {
+        temp_set_fault(g_temp_hot);
+        return TEMP_HOT;
+    }
+
+    stale = 0;
+    for (i = 0 ; i < TEMP_N_PAGES ; i++)
+    {
+        if ((bit_test(g_temp_seen,i) == 0) || ((now - g_temp_page_ms[i]) > BPS_TEMP_TIMEOUT_MS))
+        {
+            bit_set(stale,i);
+        }
+    }
+    if (stale != 0)
+    {
+        temp_set_fault(stale);
+        return TEMP_STALE;
+    }
+
+    if (g_temp_rising != 0)
+    {
+        temp_set_fault(g_temp_rising);
+        return TEMP_RISING;
+    }
+
+    if (g_temp_warm != 0)
+    {
+        return TEMP_HOLD;
+    }
+
+    return TEMP_SAFE;
+}
+
+// Returns the page (1-3) behind the last verdict other than SAFE or HOLD
+int8 temp_fault_page(void)
+{
+    return g_temp_fault_page;
+}
+
+// Returns the hottest cell (0-7) of the fault page
+int8 temp_fault_cell(void)
+{
+    return g_temp_page_cell[g_temp_fault_page - 1];
+}
+
+// Returns the hottest reading of the fault page
+int8 temp_fault_max(void)
+{
+    return g_temp_page_max[g_temp_fault_page - 1];
+}
+
+// Returns the rise of the fault page since the start of its rise window
+int8 temp_fault_rise(void)
+{
+    return g_temp_page_rise[g_temp_fault_page - 1];
+}
@@ -0,0 +1,64 @@
+#ifndef PMS_TEMP_H
+#define PMS_TEMP_H
+
+// Battery temperature supervisor
+// Keeps the hottest reading of each CAN_BPS_TEMPERATUREx page and the tick it
+// arrived on, so the array decision covers the whole pack instead of the
+// last page received. Pages over the warning threshold are tracked as bit
+// masks that are updated as each frame arrives, so the decision never needs
+// to rescan the pages.
+//
+// The array may only be connected when every page has been received within
+// BPS_TEMP_TIMEOUT_MS and all of them are below the warning threshold by at
+// least BPS_TEMP_HYSTERESIS. A page at or over the warning threshold, a page
+// that has gone stale, or a page heating faster than PARAM_BPS_TEMP_RISE_LIMIT
+// per PARAM_BPS_TEMP_RISE_WINDOW_MS disconnects it. A page at or over the critical
+// threshold also disconnects the motor until it has cooled by
+// BPS_TEMP_HYSTERESIS. A frame shorter than TEMP_PAGE_LEN is ignored, so a
+// BPS sending empty or truncated pages is seen as stale.
+//
+// temp_scan finds the hottest cell of a page. On the PIC18 it is unrolled but
+// not branch-free: the core has no conditional move and no branch predictor,
+// a compare and skip costs one extra cycle when taken and the time stays
+// bounded, while a mask and select formulation needs a borrow-to-mask
+// sequence for both the value and the index of every cell, about twice the
+// cycles. Host and ARM builds use a branch-free SIMD within a register scan.
+//
+// The rate of rise is measured against a reference reading taken at the start
+// of each window, so a page is flagged as soon as it has risen by the limit
+// and cleared once a whole window passes with less than that.
+
+// BMS temperature limits
+// The warning and critical thresholds and the rate of rise limit and window
+// are the defaults of the runtime parameters in pms_param.h
+#define BPS_TEMP_WARNING            58 // 60C charge limit, PMS should disconnect the array before the warning threshold is reached
+#define BPS_TEMP_CRITICAL           70 // 70C discharge limit
+#define BPS_TEMP_HYSTERESIS          3 // A page must cool this far below a threshold before it clears
+#define BPS_TEMP_TIMEOUT_MS       3000 // A page not received for this long is stale
+#define BPS_TEMP_RISE_LIMIT          3 // Rise within one window that counts as heating too fast
+#define BPS_TEMP_RISE_WINDOW_MS  60000 // Length of the rate of rise window
+
+#define TEMP_N_PAGES                 3 // CAN_BPS_TEMPERATURE1 - CAN_BPS_TEMPERATURE3
+#define TEMP_PAGE_LEN                8 // Cells per page
+
+// Verdicts in increasing order of severity
+typedef enum
+{
+    TEMP_SAFE,    // All pages fresh and below the reconnect threshold
+    TEMP_HOLD,    // All pages fresh, at least one inside the hysteresis band
+    TEMP_RISING,  // A page is heating faster than the rise limit
+    TEMP_STALE,   // A page has not been received recently, or ever
+    TEMP_HOT,     // A page is at or over the warning threshold
+    TEMP_CRITICAL // A page is at or over the critical threshold
+} temp_status_t;
+
+void          temp_init(void);
+int8          temp_scan(int8 * data, int8 len, int8 * cell);
+void          temp_update(int8 page, int8 * data, int8 len, int32 now);
+temp_status_t temp_check(int32 now);
+int8          temp_fault_page(void);
+int8          temp_fault_cell(void);
+int8          temp_fault_max(void);
+int8          temp_fault_rise(void);
+
+#endif
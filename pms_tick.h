@@ -0,0 +1,52 @@
+#ifndef PMS_TICK_H
+#define PMS_TICK_H
+
+// Millisecond time base
+// g_tick_ms is incremented by the timer2 interrupt every 1ms and wraps after
+// roughly 49 days, compare times by subtraction so the wrap is harmless
+
+static int32 g_tick_ms = 0;
+
+// Returns the current millisecond tick
+// The 32-bit counter is updated by isr_timer2, so the interrupt is masked
+// while it is copied to avoid reading a half-updated value
+int32 tick_ms(void)
+{
+    int32 now;
+
+    disable_interrupts(INT_TIMER2);
+    now = g_tick_ms;
+    enable_interrupts(INT_TIMER2);
+
+    return now;
+}
+
+// Startup time
+// Timer 1 runs at Fosc/4 / STARTUP_TIMER_DIV from the top of main, 1.6us per
+// count with a 20MHz clock, and startup_us reads it once the PMS is up. It is
+// free once that has been sent.
+#define STARTUP_TIMER_DIV     8
+#define STARTUP_US_MAX   0xFFFF // Reported for a startup of 65ms or more
+
+void startup_timer_start(void)
+{
+    setup_timer_1(T1_INTERNAL | T1_DIV_BY_8);
+    set_timer1(0);
+    clear_interrupt(INT_TIMER1);
+}
+
+// Returns the time since startup_timer_start in us
+int16 startup_us(void)
+{
+    int32 us;
+
+    us = (int32)get_timer1() * (4 * STARTUP_TIMER_DIV) / (getenv("CLOCK") / 1000000);
+    if (interrupt_active(INT_TIMER1) || (us > STARTUP_US_MAX))
+    {
+        // The timer wrapped
+        return STARTUP_US_MAX;
+    }
+    return us;
+}
+
+#endif
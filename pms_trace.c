@@ -0,0 +1,133 @@
+// PMS event trace
+// Logging an event is a handful of stores, it is cheap enough to call from
+// the state machine on every relay action and received command
+
+#include "pms_trace.h"
+
+static trace_entry_t g_trace[TRACE_DEPTH];
+static int8          g_trace_head  = 0;     // Next entry to be written
+static int8          g_trace_count = 0;     // Number of valid entries
+static int16         g_trace_total = 0;     // Events logged since reset
+static int1          gb_trace_dumping = false;
+static int1          gb_trace_held = false;
+static int8          g_trace_dump_seq;
+
+// Adds an event to the trace, overwriting the oldest entry when full
+void trace_log(trace_event_t event, int16 arg)
+{
+    trace_entry_t * entry;
+
+    g_trace_total++;
+    if ((gb_trace_dumping == true) || (gb_trace_held == true))
+    {
+        // Keep the buffer stable while it is being dumped
+        return;
+    }
+
+    entry = &g_trace[g_trace_head];
+    entry->ms    = tick_ms();
+    entry->arg   = arg;
+    entry->event = event;
+
+    g_trace_head = (g_trace_head + 1) & TRACE_MASK;
+    if (g_trace_count < TRACE_DEPTH)
+    {
+        g_trace_count++;
+    }
+}
+
+// Starts streaming the trace, restarts the dump if one is in progress
+void trace_dump_start(void)
+{
+    gb_trace_dumping = true;
+    g_trace_dump_seq = 0;
+}
+
+int1 trace_dump_pending(void)
+{
+    return gb_trace_dumping;
+}
+
+// Fills frame with the next dump frame and returns its length
+// The dump ends after the newest entry has been returned
+int8 trace_dump_frame(int8 * frame)
+{
+    trace_entry_t * entry;
+    int32 now;
+
+    if (g_trace_dump_seq == 0)
+    {
+        now = tick_ms();
+        frame[0] = 0;
+        frame[1] = g_trace_count;
+        frame[2] = make8(g_trace_total,0);
+        frame[3] = make8(g_trace_total,1);
+        frame[4] = make8(now,0);
+        frame[5] = make8(now,1);
+        frame[6] = make8(now,2);
+        frame[7] = make8(now,3);
+    }
+    else
+    {
+        // Entries are sent oldest first
+        entry = &g_trace[(g_trace_head - g_trace_count + g_trace_dump_seq - 1) & TRACE_MASK];
+        frame[0] = g_trace_dump_seq;
+        frame[1] = entry->event;
+        frame[2] = make8(entry->arg,0);
+        frame[3] = make8(entry->arg,1);
+        frame[4] = make8(entry->ms,0);
+        frame[5] = make8(entry->ms,1);
+        frame[6] = make8(entry->ms,2);
+        frame[7] = make8(entry->ms,3);
+    }
+
+    if (g_trace_dump_seq >= g_trace_count)
+    {
+        // Last frame, resume logging
+        gb_trace_dumping = false;
+    }
+    else
+    {
+        g_trace_dump_seq++;
+    }
+
+    return TRACE_FRAME_LEN;
+}
+
+// Suspends logging while the trace is read with trace_byte
+void trace_hold(int1 hold)
+{
+    gb_trace_held = hold;
+}
+
+int8 trace_count(void)
+{
+    return g_trace_count;
+}
+
+int16 trace_total(void)
+{
+    return g_trace_total;
+}
+
+// Returns the byte at offset of the entries, oldest first
+int8 trace_byte(int16 offset)
+{
+    trace_entry_t * entry;
+    int8 n;
+    int8 field;
+
+    n     = offset / TRACE_RECORD_LEN;
+    field = offset % TRACE_RECORD_LEN;
+    entry = &g_trace[(g_trace_head - g_trace_count + n) & TRACE_MASK];
+    switch(field)
+    {
+        case 0:
+            return entry->event;
+        case 1:
+        case 2:
+            return make8(entry->arg,field - 1);
+        default:
+            return make8(entry->ms,field - 3);
+    }
+}
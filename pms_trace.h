@@ -0,0 +1,75 @@
+#ifndef PMS_TRACE_H
+#define PMS_TRACE_H
+
+// PMS event trace
+// A fixed-size ring buffer of timestamped events kept in RAM, so the sequence
+// of events leading up to a BPS trip can be read back over CAN bus
+//
+// Dump protocol:
+// COMMAND_PMS_TRACE_DUMP starts a dump, the PMS then streams one frame per
+// pass through the idle state on RESPONSE_PMS_TRACE_DUMP, oldest entry first.
+// Multi-byte fields are little endian.
+//
+//   Header (sequence 0): 0x00, entry count, total events logged (16-bit),
+//                        current tick in ms (32-bit)
+//   Entry  (sequence n): n, event, argument (16-bit), tick in ms (32-bit)
+//
+// Logging is suspended while a dump is in progress so the buffer stays
+// consistent, events logged during a dump are only counted in the total
+//
+// The trace can also be read as one segmented transfer (pms_isotp.h),
+// trace_byte returns the entries oldest first, TRACE_RECORD_LEN bytes each
+// laid out as bytes 1-7 of a dump entry frame. trace_hold suspends logging
+// the same way for the length of the transfer.
+
+#define TRACE_DEPTH         32 // Number of entries kept, must be a power of 2
+#define TRACE_MASK          (TRACE_DEPTH - 1)
+#define TRACE_FRAME_LEN      8 // Length of every dump frame
+#define TRACE_RECORD_LEN     7 // Bytes per entry read by trace_byte
+
+typedef enum
+{
+    TRACE_BOOT,           // arg: number of boots recorded in the EEPROM log
+    TRACE_STATE,          // arg: state entered (pms_state_t)
+    TRACE_ARRAY_ON,       // MPPT relay closed
+    TRACE_ARRAY_OFF,      // MPPT relay opened
+    TRACE_MOTOR_ON,       // Motor relay closed
+    TRACE_MOTOR_OFF,      // Motor relay opened
+    TRACE_PRECHARGE,      // arg: 1 when precharge starts, 0 when it ends
+    TRACE_RX_COMMAND,     // arg: CAN ID of the received command
+    TRACE_TEMP_VIOLATION, // arg: hottest cell (0-7) in the high byte, BPS temperature page (1-3) in the low byte
+    TRACE_TX_FAIL,        // arg: CAN ID of the frame that could not be sent
+    TRACE_BRAKE,          // arg: 1 when pressed, 0 when released
+    TRACE_TEMP_STALE,     // arg: BPS temperature page (1-3) that stopped arriving
+    TRACE_TEMP_RISING,    // arg: rise in the high byte, BPS temperature page (1-3) in the low byte
+    TRACE_TEMP_CRITICAL,  // arg: hottest cell (0-7) in the high byte, BPS temperature page (1-3) in the low byte
+    TRACE_BPS_TRIP,       // arg: number of BPS trips since reset
+    TRACE_TRIP_RESET,     // arg: PMS_TRIP_RESET_xxx result of a reset command
+    TRACE_PARAM,          // arg: PMS_PARAM_xxx result in the high byte, parameter index in the low byte
+    TRACE_PRECHARGE_DONE, // arg: precharge time in ms, the top bit is set for a timed precharge
+    TRACE_PRECHARGE_FAIL, // arg: precharge sense reading when the precharge timed out
+    TRACE_DCDC_DERATE,    // arg: DC/DC temperature in 0.1 degrees C, horn locked out
+    TRACE_DCDC_CRITICAL,  // arg: DC/DC temperature in 0.1 degrees C, motor disconnected
+    TRACE_DCDC_NORMAL,    // arg: DC/DC temperature in 0.1 degrees C, protection cleared
+    TRACE_AUX_UV,         // arg: undervoltage stage (aux_uv_t) in the high byte, lowest aux cell (0-3) in the low byte
+    TRACE_CAN_INIT_FAIL,  // arg: CAN operating mode (CANSTAT opmode) the module was left in
+    N_TRACE_EVENTS
+} trace_event_t;
+
+typedef struct
+{
+    int32 ms;    // Tick when the event was logged
+    int16 arg;   // Event argument
+    int8  event; // trace_event_t
+} trace_entry_t;
+
+void trace_log(trace_event_t event, int16 arg);
+void trace_dump_start(void);
+int1 trace_dump_pending(void);
+int8 trace_dump_frame(int8 * frame);
+void trace_hold(int1 hold);
+int8 trace_count(void);
+int16 trace_total(void);
+int8 trace_byte(int16 offset);
+
+#endif
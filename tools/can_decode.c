@@ -0,0 +1,564 @@
+// Host-side CAN log decoder and analytics for PMS and BPS telemetry
+// Copyright 2016, McMaster Solar Car Project
+// Decodes candump logs using the packet tables in can_telem.h, so the byte
+// layout of the CAN_PMS_xxx packets and the BPS temperature pages is never
+// hand-decoded. Signals with the "u16" unit are read as two bytes, little endian.
+// CAN_PMS_DATA is multiplexed, each frame only carries the signals of its
+// sub-page and frames of another layout version are counted and skipped.
+// The log is memory-mapped and parsed without stdio, which keeps multi-day
+// race logs to a few seconds of processing.
+//
+// Both candump output styles are accepted:
+//   (1476735700.123456) can0 60E#0102030405060708       (candump -l)
+//   (1476735700.123456)  can0  60E   [8]  01 02 03 ...  (candump -ta)
+//
+// Build: gcc -O2 -o can_decode tools/can_decode.c
+// Usage: can_decode [-o prefix] [-s] candump.log
+//   -o prefix  write one CSV file per packet type, named <prefix><packet>.csv
+//   -s         print per-packet statistics (count, largest gap, signal
+//              min/max/mean) to stdout
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../can_telem.h"
+
+#define MAX_SIGNALS    24
+#define N_BPS_SIGNALS   8
+#define MAX_STD_ID     0x800
+#define CSV_BUFFER_LEN (1 << 20)
+
+typedef struct
+{
+    unsigned     id;
+    const char * name;
+    int          n_signals;
+    int          muxed;              // Byte 0 is a PMS_DATA_MUX byte
+    const char * signal[MAX_SIGNALS];
+    const char * unit[MAX_SIGNALS];
+    int          byte[MAX_SIGNALS];
+    int          type[MAX_SIGNALS];  // PMS_TYPE_xxx
+    int          mux[MAX_SIGNALS];   // Sub-page carrying the signal, -1 in every frame
+
+    // CSV output
+    FILE *       csv;
+    char *       buf;
+    size_t       used;
+
+    // Analytics
+    unsigned long long count;
+    long long          last_us;
+    long long          max_gap_us;
+    unsigned long long n[MAX_SIGNALS];
+    int                min[MAX_SIGNALS];
+    int                max[MAX_SIGNALS];
+    long long          sum[MAX_SIGNALS];
+} message_t;
+
+#define EXPAND_AS_MESSAGE(a,b,c)      {.id = b, .name = #a},
+#define EXPAND_AS_MISC_MESSAGE(a,b)   {.id = b, .name = #a},
+#define EXPAND_AS_SIGNAL_NAME(a,b,c)  #a,
+#define EXPAND_AS_SIGNAL_BYTE(a,b,c)  b,
+#define EXPAND_AS_SIGNAL_UNIT(a,b,c)  c,
+
+static message_t g_messages[] =
+{
+    CAN_ID_TABLE(EXPAND_AS_MESSAGE)
+    CAN_MISC_TABLE(EXPAND_AS_MISC_MESSAGE)
+};
+#define N_MESSAGES ((int)(sizeof(g_messages) / sizeof(g_messages[0])))
+
+static const char * g_pms_data_name[]  = {CAN_PMS_DATA_TABLE(EXPAND_AS_DATA_NAME)};
+static const int    g_pms_data_mux[]   = {CAN_PMS_DATA_TABLE(EXPAND_AS_DATA_MUX)};
+static const int    g_pms_data_byte[]  = {CAN_PMS_DATA_TABLE(EXPAND_AS_DATA_BYTE)};
+static const int    g_pms_data_type[]  = {CAN_PMS_DATA_TABLE(EXPAND_AS_DATA_TYPE)};
+static const char * g_pms_data_unit[]  = {CAN_PMS_DATA_TABLE(EXPAND_AS_DATA_UNIT)};
+static const char * g_pms_fault_name[] = {CAN_PMS_FAULT_TABLE(EXPAND_AS_SIGNAL_NAME)};
+static const int    g_pms_fault_byte[] = {CAN_PMS_FAULT_TABLE(EXPAND_AS_SIGNAL_BYTE)};
+static const char * g_pms_fault_unit[] = {CAN_PMS_FAULT_TABLE(EXPAND_AS_SIGNAL_UNIT)};
+static const char * g_bps_signal_name[] = {"temp1", "temp2", "temp3", "temp4",
+                                           "temp5", "temp6", "temp7", "temp8"};
+
+static signed char g_lookup[MAX_STD_ID];
+static unsigned long long g_unknown = 0;
+static unsigned long long g_malformed = 0;
+static unsigned long long g_bad_version = 0;
+
+// Fills the signals of a message from one of the signal tables
+static void set_signals(message_t * m, int n, const char * const * name, const int * byte,
+                        const char * const * unit)
+{
+    int j;
+
+    m->n_signals = n;
+    for (j = 0 ; j < n ; j++)
+    {
+        m->signal[j] = name[j];
+        m->unit[j] = unit[j];
+        m->byte[j] = byte[j];
+        m->type[j] = (strcmp(unit[j], "u16") == 0) ? PMS_TYPE_U16 : PMS_TYPE_U8;
+        m->mux[j] = -1;
+    }
+}
+
+static void setup_messages(void)
+{
+    int i;
+    int j;
+
+    memset(g_lookup, -1, sizeof(g_lookup));
+    for (i = 0 ; i < N_MESSAGES ; i++)
+    {
+        message_t * m = &g_messages[i];
+        if (m->id == CAN_PMS_DATA_ID)
+        {
+            set_signals(m, N_PMS_DATA_SIGNALS, g_pms_data_name, g_pms_data_byte, g_pms_data_unit);
+            m->muxed = 1;
+            for (j = 0 ; j < N_PMS_DATA_SIGNALS ; j++)
+            {
+                m->type[j] = g_pms_data_type[j];
+                m->mux[j] = g_pms_data_mux[j];
+            }
+        }
+        else if (m->id == CAN_PMS_FAULT_ID)
+        {
+            set_signals(m, N_PMS_FAULT_SIGNALS, g_pms_fault_name, g_pms_fault_byte, g_pms_fault_unit);
+        }
+        else if ((m->id == CAN_BPS_TEMPERATURE1_ID) || (m->id == CAN_BPS_TEMPERATURE2_ID) ||
+                 (m->id == CAN_BPS_TEMPERATURE3_ID))
+        {
+            m->n_signals = N_BPS_SIGNALS;
+            for (j = 0 ; j < N_BPS_SIGNALS ; j++)
+            {
+                m->signal[j] = g_bps_signal_name[j];
+                m->unit[j] = "degC";
+                m->byte[j] = j;
+                m->type[j] = PMS_TYPE_U8;
+                m->mux[j] = -1;
+            }
+        }
+        for (j = 0 ; j < MAX_SIGNALS ; j++)
+        {
+            m->min[j] = INT_MAX;
+            m->max[j] = INT_MIN;
+        }
+        m->last_us = -1;
+        if (m->id < MAX_STD_ID)
+        {
+            g_lookup[m->id] = (signed char)i;
+        }
+    }
+}
+
+static void csv_flush(message_t * m)
+{
+    if (m->used > 0)
+    {
+        fwrite(m->buf, 1, m->used, m->csv);
+        m->used = 0;
+    }
+}
+
+static void open_csv(const char * prefix)
+{
+    char path[4096];
+    int i;
+    int j;
+
+    for (i = 0 ; i < N_MESSAGES ; i++)
+    {
+        message_t * m = &g_messages[i];
+        snprintf(path, sizeof(path), "%s%s.csv", prefix, m->name);
+        m->csv = fopen(path, "w");
+        if (m->csv == NULL)
+        {
+            perror(path);
+            exit(1);
+        }
+        m->buf = malloc(CSV_BUFFER_LEN);
+        fputs("time", m->csv);
+        if (m->n_signals == 0)
+        {
+            fputs(",len,data", m->csv);
+        }
+        for (j = 0 ; j < m->n_signals ; j++)
+        {
+            fprintf(m->csv, ",%s", m->signal[j]);
+        }
+        fputc('\n', m->csv);
+    }
+}
+
+static int hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    return -1;
+}
+
+static char * put_uint(char * out, unsigned v);
+
+static char * put_int(char * out, int v)
+{
+    if (v < 0)
+    {
+        *out++ = '-';
+        return put_uint(out, (unsigned)(-(long long)v));
+    }
+    return put_uint(out, (unsigned)v);
+}
+
+static char * put_uint(char * out, unsigned v)
+{
+    char tmp[12];
+    int n = 0;
+
+    do
+    {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+    while (n > 0)
+    {
+        *out++ = tmp[--n];
+    }
+    return out;
+}
+
+// Returns true if signal i is in a frame of length len on sub-page page
+static int signal_present(const message_t * m, int i, int page, int len)
+{
+    int last = m->byte[i] + ((m->type[i] == PMS_TYPE_U8) ? 0 : 1);
+    return (last < len) && ((m->mux[i] < 0) || (m->mux[i] == page));
+}
+
+// Returns signal i of a frame, check signal_present first
+static int signal_value(const message_t * m, int i, const unsigned char * data)
+{
+    int v;
+
+    if (m->type[i] == PMS_TYPE_U8)
+    {
+        return data[m->byte[i]];
+    }
+    v = data[m->byte[i]] | (data[m->byte[i] + 1] << 8);
+    if ((m->type[i] == PMS_TYPE_S16) && (v >= 0x8000))
+    {
+        v -= 0x10000;
+    }
+    return v;
+}
+
+// Records one decoded frame
+static void decode_frame(message_t * m, const char * ts, int ts_len, long long us,
+                         const unsigned char * data, int len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char * out;
+    int page = -1;
+    int i;
+
+    if (m->muxed)
+    {
+        if ((len < 1) || ((data[PMS_DATA_MUX] >> 4) != PMS_DATA_VERSION))
+        {
+            g_bad_version++;
+            return;
+        }
+        page = data[PMS_DATA_MUX] & 0x0F;
+    }
+
+    m->count++;
+    if ((us >= 0) && (m->last_us >= 0) && (us - m->last_us > m->max_gap_us))
+    {
+        m->max_gap_us = us - m->last_us;
+    }
+    m->last_us = us;
+
+    for (i = 0 ; i < m->n_signals ; i++)
+    {
+        int v;
+        if (!signal_present(m, i, page, len))
+        {
+            continue;
+        }
+        v = signal_value(m, i, data);
+        if (v < m->min[i]) m->min[i] = v;
+        if (v > m->max[i]) m->max[i] = v;
+        m->sum[i] += v;
+        m->n[i]++;
+    }
+
+    if (m->csv == NULL)
+    {
+        return;
+    }
+    if (m->used + ts_len + 8 * MAX_SIGNALS > CSV_BUFFER_LEN)
+    {
+        csv_flush(m);
+    }
+
+    out = m->buf + m->used;
+    memcpy(out, ts, (size_t)ts_len);
+    out += ts_len;
+    if (m->n_signals == 0)
+    {
+        *out++ = ',';
+        out = put_uint(out, (unsigned)len);
+        *out++ = ',';
+        for (i = 0 ; i < len ; i++)
+        {
+            *out++ = hex[data[i] >> 4];
+            *out++ = hex[data[i] & 0x0F];
+        }
+    }
+    for (i = 0 ; i < m->n_signals ; i++)
+    {
+        *out++ = ',';
+        if (signal_present(m, i, page, len))
+        {
+            out = put_int(out, signal_value(m, i, data));
+        }
+    }
+    *out++ = '\n';
+    m->used = (size_t)(out - m->buf);
+}
+
+// Parses one candump line, returns 0 if the line is not a CAN frame
+static int parse_line(const char * p, const char * end, unsigned long long line_no)
+{
+    unsigned char data[8];
+    char line_ts[24];
+    const char * ts = line_ts;
+    int ts_len;
+    long long us = -1;
+    unsigned id = 0;
+    int len = 0;
+    int digits = 0;
+    int h;
+    int l;
+
+    while ((p < end) && ((*p == ' ') || (*p == '\t'))) p++;
+    if (p >= end) return 0;
+
+    if (*p == '(')
+    {
+        // Timestamp in seconds with a microsecond fraction
+        long long sec = 0;
+        long long frac = 0;
+        int frac_digits = 0;
+        ts = ++p;
+        while ((p < end) && (*p >= '0') && (*p <= '9')) sec = sec * 10 + (*p++ - '0');
+        if ((p < end) && (*p == '.'))
+        {
+            p++;
+            while ((p < end) && (*p >= '0') && (*p <= '9'))
+            {
+                if (frac_digits < 6)
+                {
+                    frac = frac * 10 + (*p - '0');
+                    frac_digits++;
+                }
+                p++;
+            }
+        }
+        while (frac_digits++ < 6) frac *= 10;
+        us = sec * 1000000 + frac;
+        ts_len = (int)(p - ts);
+        while ((p < end) && (*p != ')')) p++;
+        if (p >= end) return 0;
+        p++;
+    }
+    else
+    {
+        ts_len = (int)(put_uint(line_ts, (unsigned)line_no) - line_ts);
+    }
+
+    // Interface name
+    while ((p < end) && ((*p == ' ') || (*p == '\t'))) p++;
+    while ((p < end) && (*p != ' ') && (*p != '\t')) p++;
+    while ((p < end) && ((*p == ' ') || (*p == '\t'))) p++;
+
+    // Identifier, either ID#DATA or ID [len] DATA
+    while ((p < end) && ((h = hex_value(*p)) >= 0))
+    {
+        id = (id << 4) | (unsigned)h;
+        digits++;
+        p++;
+    }
+    if ((digits == 0) || (p >= end)) return 0;
+
+    if (*p == '#')
+    {
+        p++;
+        while ((p + 1 < end) && (len < 8) && ((h = hex_value(p[0])) >= 0) &&
+               ((l = hex_value(p[1])) >= 0))
+        {
+            data[len++] = (unsigned char)((h << 4) | l);
+            p += 2;
+        }
+    }
+    else
+    {
+        int dlc;
+        while ((p < end) && (*p == ' ')) p++;
+        if ((p + 2 >= end) || (p[0] != '[')) return 0;
+        dlc = p[1] - '0';
+        if ((dlc < 0) || (dlc > 8)) return 0;
+        p += 3;
+        while ((len < dlc) && (p < end))
+        {
+            while ((p < end) && (*p == ' ')) p++;
+            if ((p + 1 >= end) || ((h = hex_value(p[0])) < 0) || ((l = hex_value(p[1])) < 0))
+            {
+                break;
+            }
+            data[len++] = (unsigned char)((h << 4) | l);
+            p += 2;
+        }
+    }
+
+    if ((id >= MAX_STD_ID) || (g_lookup[id] < 0))
+    {
+        g_unknown++;
+        return 1;
+    }
+    decode_frame(&g_messages[(int)g_lookup[id]], ts, ts_len, us, data, len);
+    return 1;
+}
+
+static void print_summary(void)
+{
+    int i;
+    int j;
+
+    printf("%-30s %5s %12s %12s\n", "packet", "id", "frames", "max gap ms");
+    for (i = 0 ; i < N_MESSAGES ; i++)
+    {
+        message_t * m = &g_messages[i];
+        if (m->count == 0)
+        {
+            continue;
+        }
+        printf("%-30s %5X %12llu %12.1f\n", m->name, m->id, m->count, m->max_gap_us / 1000.0);
+        for (j = 0 ; j < m->n_signals ; j++)
+        {
+            if (m->n[j] == 0)
+            {
+                continue;
+            }
+            printf("    %-26s min %3d  max %3d  mean %7.2f %s\n", m->signal[j], m->min[j], m->max[j],
+                   (double)m->sum[j] / (double)m->n[j], m->unit[j]);
+        }
+    }
+    printf("unknown frames: %llu, unparsed lines: %llu, other layout versions: %llu\n",
+           g_unknown, g_malformed, g_bad_version);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * prefix = NULL;
+    const char * path = NULL;
+    int summary = 0;
+    struct stat st;
+    const char * p;
+    const char * end;
+    char * map;
+    unsigned long long line_no = 0;
+    int fd;
+    int i;
+
+    for (i = 1 ; i < argc ; i++)
+    {
+        if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc))
+        {
+            prefix = argv[++i];
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            summary = 1;
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if ((path == NULL) || ((prefix == NULL) && (summary == 0)))
+    {
+        fprintf(stderr, "usage: %s [-o prefix] [-s] candump.log\n", argv[0]);
+        return 2;
+    }
+
+    fd = open(path, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) != 0))
+    {
+        perror(path);
+        return 1;
+    }
+    if (st.st_size == 0)
+    {
+        map = NULL;
+        end = NULL;
+    }
+    else
+    {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            perror("mmap");
+            return 1;
+        }
+        madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+
+    setup_messages();
+    if (prefix != NULL)
+    {
+        open_csv(prefix);
+    }
+
+    p = map;
+    end = (map != NULL) ? map + st.st_size : NULL;
+    while (p < end)
+    {
+        const char * eol = memchr(p, '\n', (size_t)(end - p));
+        if (eol == NULL)
+        {
+            eol = end;
+        }
+        line_no++;
+        if ((eol > p) && (parse_line(p, eol, line_no) == 0))
+        {
+            g_malformed++;
+        }
+        p = eol + 1;
+    }
+
+    for (i = 0 ; i < N_MESSAGES ; i++)
+    {
+        if (g_messages[i].csv != NULL)
+        {
+            csv_flush(&g_messages[i]);
+            fclose(g_messages[i].csv);
+            free(g_messages[i].buf);
+        }
+    }
+    if (summary)
+    {
+        print_summary();
+    }
+
+    if (map != NULL)
+    {
+        munmap(map, (size_t)st.st_size);
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Host-side decoder for the CAN driver deferred debug log
+// Copyright 2016, McMaster Solar Car Project
+// Reads the raw byte stream captured from the PMS UART (file or stdin) and
+// expands each record using the format table in can_dlog.h
+//
+// Build: gcc -O2 -o dlog_decode tools/dlog_decode.c
+// Usage: dlog_decode [capture.bin]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../can_dlog.h"
+
+#define EXPAND_AS_SIGNATURE(a,b,c) b,
+#define EXPAND_AS_FORMAT(a,b,c)    c,
+
+static const char * g_signature[N_DLOG_FORMATS] = {DLOG_FORMAT_TABLE(EXPAND_AS_SIGNATURE)};
+static const char * g_format[N_DLOG_FORMATS]    = {DLOG_FORMAT_TABLE(EXPAND_AS_FORMAT)};
+
+typedef struct
+{
+    unsigned long value;
+    unsigned char data[255];
+    int           len;
+} dlog_arg_t;
+
+// Reads the arguments of a record according to its signature
+// Returns the number of arguments, or -1 if the stream ended
+static int read_args(FILE * in, const char * signature, dlog_arg_t * args)
+{
+    int n = 0;
+    int c;
+    int i;
+
+    for ( ; *signature != '\0' ; signature++, n++)
+    {
+        args[n].value = 0;
+        args[n].len = 0;
+        switch (*signature)
+        {
+            case 'B':
+                if ((c = fgetc(in)) == EOF) return -1;
+                args[n].value = (unsigned long)c;
+                break;
+            case 'L':
+                for (i = 0 ; i < 4 ; i++)
+                {
+                    if ((c = fgetc(in)) == EOF) return -1;
+                    args[n].value |= (unsigned long)c << (8 * i);
+                }
+                break;
+            case 'D':
+                if ((c = fgetc(in)) == EOF) return -1;
+                args[n].len = c;
+                for (i = 0 ; i < args[n].len ; i++)
+                {
+                    if ((c = fgetc(in)) == EOF) return -1;
+                    args[n].data[i] = (unsigned char)c;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return n;
+}
+
+// Expands a format string with decoded arguments
+static void print_record(FILE * out, const char * format, const dlog_arg_t * args, int n_args)
+{
+    int arg = 0;
+    int i;
+
+    for ( ; *format != '\0' ; format++)
+    {
+        if ((*format != '%') || (format[1] == '\0'))
+        {
+            fputc(*format, out);
+            continue;
+        }
+
+        format++;
+        if (*format == 'l')
+        {
+            format++;
+        }
+        if (*format == '%')
+        {
+            fputc('%', out);
+            continue;
+        }
+        if (arg >= n_args)
+        {
+            fputs("<?>", out);
+            continue;
+        }
+
+        switch (*format)
+        {
+            case 'u':
+                fprintf(out, "%lu", args[arg].value);
+                break;
+            case 'X':
+                fprintf(out, "%lX", args[arg].value);
+                break;
+            case 's':
+                for (i = 0 ; i < args[arg].len ; i++)
+                {
+                    fprintf(out, "%02X ", args[arg].data[i]);
+                }
+                break;
+            default:
+                fputc(*format, out);
+                break;
+        }
+        arg++;
+    }
+    fputc('\n', out);
+}
+
+int main(int argc, char ** argv)
+{
+    FILE * in = stdin;
+    dlog_arg_t args[16];
+    long skipped = 0;
+    int c;
+    int n;
+
+    if (argc > 1)
+    {
+        in = fopen(argv[1], "rb");
+        if (in == NULL)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    while ((c = fgetc(in)) != EOF)
+    {
+        if (c != DLOG_SYNC)
+        {
+            // Resynchronise after line noise or a partial capture
+            skipped++;
+            continue;
+        }
+
+        if ((c = fgetc(in)) == EOF)
+        {
+            break;
+        }
+        if (c >= N_DLOG_FORMATS)
+        {
+            skipped += 2;
+            continue;
+        }
+
+        n = read_args(in, g_signature[c], args);
+        if (n < 0)
+        {
+            fprintf(stderr, "dlog_decode: truncated record at end of input\n");
+            break;
+        }
+        print_record(stdout, g_format[c], args, n);
+    }
+
+    if (skipped > 0)
+    {
+        fprintf(stderr, "dlog_decode: skipped %ld bytes while resynchronising\n", skipped);
+    }
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    return 0;
+}
@@ -0,0 +1,336 @@
+// Micro-benchmarks for the ECAN driver routines on the host build
+// Copyright 2016, McMaster Solar Car Project
+//
+// Runs can_set_id, can_get_id, can_putd and can_getd from can18F4580_mscp.c,
+// converted by ccs2host.py, against the simulated register file. The ECAN
+// access window is not remapped on the host, so the numbers measure the work
+// the driver does per call (ID packing, window selection, buffer scanning and
+// copying) rather than PIC cycle counts. Compare runs of the same host before
+// and after a driver change.
+//
+// Build (from the repository root):
+//   python3 tools/host/ccs2host.py can18F4580_mscp.c -o can_host.cpp
+//   g++ -O2 -std=gnu++17 -fpermissive -Wall -I. -Itools/host -o can_bench
+//       tools/host/can_bench.cpp
+// Usage: can_bench [filter]
+//   Runs the benchmarks whose name contains filter, all of them by default
+
+#include <chrono>
+#include <stdlib.h>
+#include <vector>
+
+#include "can_host.cpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC 1
+#endif
+
+#define BENCH_MIN_TIME_S 0.5
+
+int8 g_sfr[0x1000];
+int8 g_ccs_adc_channel;
+int1 g_ccs_int_enabled[CCS_N_INTS];
+int8 g_ccs_eeprom[1024];
+
+void  ccs_pin_write(int8 pin, int1 value) { (void)pin; (void)value; }
+int1  ccs_pin_read(int8 pin) { (void)pin; return 0; }
+int1  ccs_pin_latch(int8 pin) { (void)pin; return 0; }
+int16 ccs_read_adc(int8 channel) { (void)channel; return 0; }
+void  ccs_delay_us(int32 us) { (void)us; }
+int1  ccs_host_loop(void) { return false; }
+void  ccs_pwm_duty(int8 ccp, int16 duty) { (void)ccp; (void)duty; }
+
+//////////////////////////////
+// BENCHMARK FRAMEWORK ///////
+//////////////////////////////
+
+// Iteration state, used as "for ([[maybe_unused]] auto _ : state)" like Google Benchmark
+class bench_state_t
+{
+public:
+    explicit bench_state_t(unsigned long long iterations) : m_iterations(iterations) {}
+
+    struct iterator
+    {
+        unsigned long long n;
+        bool operator!=(const iterator & other) const { return n != other.n; }
+        void operator++() { n++; }
+        int operator*() const { return 0; }
+    };
+    iterator begin() const { return iterator{0}; }
+    iterator end() const { return iterator{m_iterations}; }
+
+private:
+    unsigned long long m_iterations;
+};
+
+typedef void (*bench_fn_t)(bench_state_t & state);
+
+typedef struct
+{
+    const char * name;
+    bench_fn_t   fn;
+} bench_t;
+
+static std::vector<bench_t> & bench_registry(void)
+{
+    static std::vector<bench_t> registry;
+    return registry;
+}
+
+struct bench_registrar_t
+{
+    bench_registrar_t(const char * name, bench_fn_t fn) { bench_registry().push_back(bench_t{name, fn}); }
+};
+
+#define BENCHMARK(fn) static bench_registrar_t fn##_registrar(#fn, fn)
+
+// Keeps the compiler from discarding a result
+template <class T> static inline void do_not_optimize(const T & value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static void run_benchmark(const bench_t & b)
+{
+    unsigned long long iterations = 1;
+    double elapsed = 0;
+    unsigned long long cycles = 0;
+
+    for (;;)
+    {
+        bench_state_t state(iterations);
+#if BENCH_HAVE_TSC
+        unsigned long long c0 = __rdtsc();
+#endif
+        auto t0 = std::chrono::steady_clock::now();
+        b.fn(state);
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+#if BENCH_HAVE_TSC
+        cycles = __rdtsc() - c0;
+#endif
+        if ((elapsed >= BENCH_MIN_TIME_S) || (iterations >= 1000000000ULL))
+        {
+            break;
+        }
+        // Aim past the minimum time on the next run
+        if (elapsed < BENCH_MIN_TIME_S / 100)
+        {
+            iterations *= 10;
+        }
+        else
+        {
+            iterations = (unsigned long long)(iterations * BENCH_MIN_TIME_S * 1.4 / elapsed);
+        }
+    }
+
+    printf("%-36s %10.2f ns %10.1f cycles %12llu\n", b.name, elapsed * 1e9 / iterations,
+           (double)cycles / iterations, iterations);
+}
+
+//////////////////////////////
+// DRIVER BENCHMARKS /////////
+//////////////////////////////
+
+static int8 g_data[8] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+
+static void set_functional_mode(CAN_FUN_OP_MODE mode)
+{
+    // can_set_functional_mode waits for the mode change, which the register
+    // file does not model, so the mode is set directly
+    ECANCON.mdsel = mode;
+    curfunmode = mode;
+}
+
+static void BM_can_set_id_standard(bench_state_t & state)
+{
+    int32 id = 0x60E;
+    for ([[maybe_unused]] auto _ : state)
+    {
+        can_set_id(TXRXBaID, id, 0);
+        do_not_optimize(id++);
+    }
+}
+BENCHMARK(BM_can_set_id_standard);
+
+static void BM_can_set_id_extended(bench_state_t & state)
+{
+    int32 id = 0x1ABCDEF;
+    for ([[maybe_unused]] auto _ : state)
+    {
+        can_set_id(TXRXBaID, id, 1);
+        do_not_optimize(id++);
+    }
+}
+BENCHMARK(BM_can_set_id_extended);
+
+static void BM_can_get_id_standard(bench_state_t & state)
+{
+    can_set_id(TXRXBaID, 0x60E, 0);
+    for ([[maybe_unused]] auto _ : state)
+    {
+        do_not_optimize(can_get_id(TXRXBaID, 0));
+    }
+}
+BENCHMARK(BM_can_get_id_standard);
+
+static void BM_can_get_id_extended(bench_state_t & state)
+{
+    can_set_id(TXRXBaID, 0x1ABCDEF, 1);
+    for ([[maybe_unused]] auto _ : state)
+    {
+        do_not_optimize(can_get_id(TXRXBaID, 1));
+    }
+}
+BENCHMARK(BM_can_get_id_extended);
+
+static void putd(bench_state_t & state, CAN_FUN_OP_MODE mode, int32 id, int1 ext)
+{
+    set_functional_mode(mode);
+    for ([[maybe_unused]] auto _ : state)
+    {
+        // Transmit buffer 0 drains immediately
+        TXB0CON.txreq = 0;
+        do_not_optimize(can_putd(id, g_data, 8, 3, ext, 0));
+    }
+}
+
+static void BM_can_putd_standard_legacy(bench_state_t & state)
+{
+    putd(state, CAN_FUN_OP_LEGACY, 0x60E, 0);
+}
+BENCHMARK(BM_can_putd_standard_legacy);
+
+static void BM_can_putd_extended_legacy(bench_state_t & state)
+{
+    putd(state, CAN_FUN_OP_LEGACY, 0x1ABCDEF, 1);
+}
+BENCHMARK(BM_can_putd_extended_legacy);
+
+static void BM_can_putd_standard_fifo(bench_state_t & state)
+{
+    putd(state, CAN_FUN_OP_ENHANCED_FIFO, 0x60E, 0);
+}
+BENCHMARK(BM_can_putd_standard_fifo);
+
+static void BM_can_putd_extended_fifo(bench_state_t & state)
+{
+    putd(state, CAN_FUN_OP_ENHANCED_FIFO, 0x1ABCDEF, 1);
+}
+BENCHMARK(BM_can_putd_extended_fifo);
+
+static void BM_can_putd_all_busy(bench_state_t & state)
+{
+    // Worst case scan when no transmit buffer is free
+    set_functional_mode(CAN_FUN_OP_LEGACY);
+    TXB0CON.txreq = 1;
+    TXB1CON.txreq = 1;
+    TXB2CON.txreq = 1;
+    BSEL0 = 0;
+    for ([[maybe_unused]] auto _ : state)
+    {
+        do_not_optimize(can_putd(0x60E, g_data, 8, 3, 0, 0));
+    }
+    TXB0CON.txreq = 0;
+    TXB1CON.txreq = 0;
+    TXB2CON.txreq = 0;
+}
+BENCHMARK(BM_can_putd_all_busy);
+
+static void getd_rxb0(bench_state_t & state, CAN_FUN_OP_MODE mode, int32 id, int1 ext)
+{
+    int32 rx_id;
+    int8 rx_data[8];
+    int8 rx_len;
+    struct rx_stat stat;
+
+    set_functional_mode(mode);
+    can_set_id(TXRXBaID, id, ext);
+    RXBaDLC = 8;
+    for ([[maybe_unused]] auto _ : state)
+    {
+        // A frame arrives in RXB0 before every call
+        RXB0CON.rxful = 1;
+        do_not_optimize(can_getd(rx_id, rx_data, rx_len, stat));
+        do_not_optimize(rx_id);
+    }
+}
+
+static void BM_can_getd_standard_legacy(bench_state_t & state)
+{
+    getd_rxb0(state, CAN_FUN_OP_LEGACY, 0x608, 0);
+}
+BENCHMARK(BM_can_getd_standard_legacy);
+
+static void BM_can_getd_extended_legacy(bench_state_t & state)
+{
+    getd_rxb0(state, CAN_FUN_OP_LEGACY, 0x1ABCDEF, 1);
+}
+BENCHMARK(BM_can_getd_extended_legacy);
+
+static void BM_can_getd_standard_fifo(bench_state_t & state)
+{
+    getd_rxb0(state, CAN_FUN_OP_ENHANCED_FIFO, 0x608, 0);
+}
+BENCHMARK(BM_can_getd_standard_fifo);
+
+static void BM_can_getd_extended_fifo(bench_state_t & state)
+{
+    getd_rxb0(state, CAN_FUN_OP_ENHANCED_FIFO, 0x1ABCDEF, 1);
+}
+BENCHMARK(BM_can_getd_extended_fifo);
+
+static void BM_can_getd_fifo_b5(bench_state_t & state)
+{
+    // Deepest FIFO entry, every earlier buffer is checked first
+    int32 rx_id;
+    int8 rx_data[8];
+    int8 rx_len;
+    struct rx_stat stat;
+
+    set_functional_mode(CAN_FUN_OP_ENHANCED_FIFO);
+    BSEL0 = 0;
+    can_set_id(TXRXBaID, 0x608, 0);
+    RXBaDLC = 8;
+    for ([[maybe_unused]] auto _ : state)
+    {
+        B5CONR.rxful = 1;
+        do_not_optimize(can_getd(rx_id, rx_data, rx_len, stat));
+        do_not_optimize(rx_id);
+    }
+}
+BENCHMARK(BM_can_getd_fifo_b5);
+
+static void BM_can_getd_empty(bench_state_t & state)
+{
+    int32 rx_id;
+    int8 rx_data[8];
+    int8 rx_len;
+    struct rx_stat stat;
+
+    set_functional_mode(CAN_FUN_OP_LEGACY);
+    BSEL0 = 0xFC;
+    for ([[maybe_unused]] auto _ : state)
+    {
+        do_not_optimize(can_getd(rx_id, rx_data, rx_len, stat));
+    }
+    BSEL0 = 0;
+}
+BENCHMARK(BM_can_getd_empty);
+
+int main(int argc, char ** argv)
+{
+    const char * filter = (argc > 1) ? argv[1] : "";
+    size_t i;
+
+    printf("%-36s %13s %17s %12s\n", "benchmark", "time", "host cycles", "iterations");
+    for (i = 0 ; i < bench_registry().size() ; i++)
+    {
+        if (strstr(bench_registry()[i].name, filter) != NULL)
+        {
+            run_benchmark(bench_registry()[i]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+// Simulated CAN driver for host builds of the PMS firmware
+// Copyright 2016, McMaster Solar Car Project
+//
+// Substituted for can18F4580_mscp.c by ccs2host.py --replace. Declares the
+// part of the driver API used by main.c, the host program implements it
+// against its own model of the bus (see replay.cpp).
+
+#ifndef CAN_SIM_H
+#define CAN_SIM_H
+
+#include "ccs_host.h"
+
+struct rx_stat
+{
+    int1 err_ovfl;  // buffer overflow
+    int8 filthit;   // filter that allowed the frame into the buffer
+    int8 buffer;    // receive buffer
+    int1 rtr;       // rtr requested
+    int1 ext;       // extended id
+    int1 inv;       // invalid id?
+};
+
+int1 can_init(void);
+int1 can_tbe(void);
+int1 can_kbhit(void);
+int8 can_putd(int32 id, int8 * data, int8 len, int8 priority, int1 ext, int1 rtr);
+int1 can_getd(int32 & id, int8 * data, int8 & len, struct rx_stat & stat);
+
+// The simulated module is always in normal mode
+#define can_get_mode() 0
+
+#endif
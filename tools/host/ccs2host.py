@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+# Converts CCS PIC C sources into a single C++ translation unit for host builds
+#
+# The firmware is written for the CCS PCH compiler, which accepts a number of
+# constructs a host compiler does not: #byte/#bit register bindings, #int_xxx
+# interrupt markers, #FUSES/#use/#device directives, upper case preprocessor
+# directives, reference parameters and an 8-bit unsigned "int". This script
+# rewrites those constructs so the unchanged firmware sources can be compiled
+# with g++ against ccs_host.h, which supplies the CCS built-ins and a simulated
+# special function register file (g_sfr).
+#
+# Usage:
+#   ccs2host.py main.c -o pms_host.cpp [--replace can18F4580_mscp.c=can_sim.h]
+#
+# Local #include files are inlined recursively. --replace substitutes a host
+# implementation for one of the firmware files (for example a simulated CAN
+# driver). The generated file must be compiled as C++ with -fpermissive.
+
+import argparse
+import os
+import re
+import sys
+
+CCS_ONLY_DIRECTIVES = (
+    'fuses', 'use', 'device', 'org', 'build', 'rom', 'priority', 'separate',
+    'inline', 'opt', 'case', 'reserve', 'zero_ram', 'ignore_warnings', 'type',
+    'nolist', 'list', 'id', 'serialize', 'export', 'import', 'fill_rom',
+)
+STANDARD_DIRECTIVES = (
+    'if', 'ifdef', 'ifndef', 'elif', 'else', 'endif', 'define', 'undef',
+    'include', 'error', 'warning', 'pragma', 'line',
+)
+DEVICE_HEADER = re.compile(r'^\d+[A-Z]+\d+[A-Z0-9]*\.h$', re.IGNORECASE)
+
+
+def read_source(path):
+    with open(path, 'r', encoding='latin-1') as f:
+        return f.read()
+
+
+def inline_includes(path, replacements, seen):
+    base = os.path.dirname(os.path.abspath(path))
+    out = []
+    for line in read_source(path).split('\n'):
+        m = re.match(r'^\s*#\s*include\s*[<"]([^>"]+)[>"]', line, re.IGNORECASE)
+        if not m:
+            out.append(line)
+            continue
+        name = m.group(1)
+        if name in replacements:
+            out.append('#include "%s"' % replacements[name])
+            continue
+        local = os.path.join(base, name)
+        if os.path.isfile(local):
+            key = os.path.abspath(local)
+            if key in seen:
+                # CCS only includes a file once when it is guarded; keep the
+                # same behaviour for unguarded files included twice
+                continue
+            seen.add(key)
+            out.append('// ---- begin %s ----' % name)
+            out.append(inline_includes(local, replacements, seen))
+            out.append('// ---- end %s ----' % name)
+        elif DEVICE_HEADER.match(os.path.basename(name)):
+            out.append('// device header %s provided by ccs_host.h' % name)
+        else:
+            out.append(line)
+    return '\n'.join(out)
+
+
+def parse_address(text):
+    m = re.search(r'0x([0-9A-Fa-f]+)(?:\.(\d))?', text)
+    if not m:
+        return None, None
+    bit = int(m.group(2)) if m.group(2) is not None else None
+    return int(m.group(1), 16), bit
+
+
+def collect_bindings(lines):
+    """Finds every #byte/#word/#bit binding and its register address"""
+    regs = {}
+    bits = {}
+    for line in lines:
+        m = re.match(r'^\s*#\s*(byte|word)\s+(\w+)\s*=\s*(.*)$', line, re.IGNORECASE)
+        if m:
+            addr, _ = parse_address(m.group(3))
+            if addr is None:
+                ref = re.match(r'\s*(\w+)', m.group(3))
+                if ref and ref.group(1) in regs:
+                    addr = regs[ref.group(1)][0]
+            if addr is None:
+                sys.exit('ccs2host: no address for register %s' % m.group(2))
+            regs[m.group(2)] = (addr, m.group(1).lower())
+            continue
+        m = re.match(r'^\s*#\s*bit\s+(\w+)\s*=\s*(.*)$', line, re.IGNORECASE)
+        if m:
+            ref = re.match(r'\s*(\w+)\.(\d)', m.group(2))
+            if ref and ref.group(1) in regs:
+                bits[m.group(1)] = (regs[ref.group(1)][0], int(ref.group(2)))
+                continue
+            addr, bit = parse_address(m.group(2))
+            if addr is None or bit is None:
+                sys.exit('ccs2host: no address for bit %s' % m.group(1))
+            bits[m.group(1)] = (addr, bit)
+    return regs, bits
+
+
+def join_continuations(text):
+    return text.replace('\\\r\n', '\\\n')
+
+
+def convert_directives(lines, regs, bits, isrs):
+    out = []
+    continuing = False
+    for line in lines:
+        if continuing:
+            out.append(line)
+            continuing = line.rstrip().endswith('\\')
+            continue
+        m = re.match(r'^(\s*)#\s*(\w+)(.*)$', line)
+        if not m:
+            out.append(line)
+            continue
+        indent, name, rest = m.groups()
+        lname = name.lower()
+        continuing = line.rstrip().endswith('\\')
+        if lname in ('byte', 'word'):
+            reg = re.match(r'\s*(\w+)', rest).group(1)
+            addr, kind = regs[reg]
+            ctype = 'int16' if kind == 'word' else 'int8'
+            if reg in DECLARED:
+                out.append('#define %s (*%s__p)' % (reg, reg))
+            else:
+                out.append('#define %s (*(%s *)&g_sfr[0x%03X])' % (reg, ctype, addr))
+            continue
+        if lname == 'bit':
+            name_ = re.match(r'\s*(\w+)', rest).group(1)
+            addr, bit = bits[name_]
+            out.append('#define %s CCS_BIT(0x%03X, %d)' % (name_, addr, bit))
+            continue
+        if lname.startswith('int_'):
+            isrs.append(lname[4:])
+            out.append('// interrupt service routine: %s' % lname)
+            continue
+        if lname in CCS_ONLY_DIRECTIVES:
+            if lname == 'use' and re.match(r'\s*delay', rest, re.IGNORECASE):
+                clk = re.search(r'clock\s*=\s*(\w+)', rest, re.IGNORECASE)
+                if clk:
+                    out.append('#define CCS_CLOCK_HZ %s' % clk.group(1))
+                    continue
+            out.append('// %s' % line.strip())
+            continue
+        if lname == 'define':
+            d = re.match(r'\s*(\w+)\s+getenv\s*\(\s*"SFR:\w+"\s*\)\s*(//.*)?$', rest)
+            if d:
+                addr, _ = parse_address(d.group(2) or '')
+                out.append('#define %s (&g_sfr[0x%03X])' % (d.group(1), addr))
+                continue
+            d = re.match(r'\s*(\w+)\s+0x([D-F][0-9A-F]{2})\s*(//.*)?$', rest)
+            if d:
+                out.append('#define %s (&g_sfr[0x%s])' % (d.group(1), d.group(2)))
+                continue
+        if lname in STANDARD_DIRECTIVES and name != lname:
+            out.append('%s#%s%s' % (indent, lname, rest))
+            continue
+        out.append(line)
+    return out
+
+
+DECLARED = set()
+
+
+def bind_declarations(text, regs):
+    """Turns register variable declarations into pointers into g_sfr"""
+    for reg, (addr, kind) in regs.items():
+        pattern = re.compile(r'(\}\s*|\bstruct\s+\w+\s+)%s(\s*;)' % re.escape(reg),
+                             re.MULTILINE)
+        decl = '*%s__p = (decltype(%s__p))&g_sfr[0x%03X]' % (reg, reg, addr)
+        text, n = pattern.subn(lambda m: m.group(1) + decl + m.group(2), text, count=1)
+        if n:
+            DECLARED.add(reg)
+    return text
+
+
+def convert_types(text):
+    text = re.sub(r'\bunsigned\s+int(8|16|32)\b', r'int\1', text)
+    text = re.sub(r'\bsigned\s+int(8|16|32)\b', r'sint\1', text)
+    text = re.sub(r'\bunsigned\s+int\b(?!\d)', 'int8', text)
+    text = re.sub(r'\bsigned\s+int\b(?!\d)', 'sint8', text)
+    text = re.sub(r'(?<![\w.])int\b(?![\d(])', 'int8', text)
+
+    def struct_body(m):
+        body = re.sub(r'\b(int1\s+\w+)\s*;', r'\1:1;', m.group(2))
+        if re.search(r':\s*\d+\s*;', body):
+            # Register structs are also read and written as whole bytes
+            body = ' CCS_REGISTER_OPS' + body
+        return m.group(1) + body + '}'
+    text = re.sub(r'(\bstruct\b[^;{}()]*\{)([^{}]*)\}', struct_body, text)
+
+    # Enumerations become plain integer typedefs so that values convert
+    # between enum types and integers the way they do in CCS
+    names = []
+
+    def enum_decl(m):
+        typedef, name, body, alias = m.groups()
+        tname = alias if typedef else name
+        if not tname:
+            return m.group(0)
+        names.append(name)
+        values = [int(v, 0) for v in re.findall(r'=\s*(0x[0-9A-Fa-f]+|\d+)', body)]
+        values.append(body.count(','))
+        ctype = 'int8' if max(values) < 256 and '(' not in body else 'int16'
+        return 'enum {%s}; typedef %s %s;' % (body, ctype, tname)
+    text = re.sub(r'(typedef\s+)?\benum\s*(\w*)\s*\{([^{}]*)\}\s*(\w*)\s*;', enum_decl, text)
+    for name in filter(None, names):
+        text = re.sub(r'\benum\s+%s\b' % name, name, text)
+    return text
+
+
+def convert_main(text):
+    m = re.search(r'\bvoid\s+main\s*\(\s*(void)?\s*\)', text)
+    if not m:
+        return text
+    text = text[:m.start()] + 'void ccs_main(void)' + text[m.end():]
+    loop = re.compile(r'while\s*\(\s*(true|TRUE|1)\s*\)')
+    lm = loop.search(text, m.start())
+    if lm:
+        text = text[:lm.start()] + 'while (ccs_host_loop())' + text[lm.end():]
+    return text
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('source')
+    parser.add_argument('-o', '--output', required=True)
+    parser.add_argument('--replace', action='append', default=[],
+                        help='firmware include to substitute, as name=host_file')
+    args = parser.parse_args()
+
+    replacements = dict(r.split('=', 1) for r in args.replace)
+    text = join_continuations(inline_includes(args.source, replacements,
+                                              {os.path.abspath(args.source)}))
+    lines = text.split('\n')
+    regs, bits = collect_bindings(lines)
+    text = bind_declarations(text, regs)
+    isrs = []
+    lines = convert_directives(text.split('\n'), regs, bits, isrs)
+    text = convert_types('\n'.join(lines))
+    # CCS converts register addresses to any pointer type implicitly
+    regnames = '|'.join(sorted(regs, key=len, reverse=True))
+    text = re.sub(r'\b(\w+)\s*=\s*&(%s)\s*;' % regnames,
+                  r'\1 = (decltype(\1))&\2;', text)
+    text = convert_main(text)
+    text = re.sub(r'\bgetenv\s*\(\s*"CLOCK"\s*\)', 'CCS_CLOCK_HZ', text)
+    text = re.sub(r'\bgetenv\s*\(', 'ccs_getenv(', text)
+
+    with open(args.output, 'w', encoding='latin-1') as f:
+        f.write('// Generated by ccs2host.py from %s, do not edit\n' %
+                os.path.basename(args.source))
+        f.write('#include "ccs_host.h"\n')
+        f.write(text)
+        f.write('\n// interrupt service routines: %s\n' % ' '.join(isrs))
+
+
+if __name__ == '__main__':
+    main()
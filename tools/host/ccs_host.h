@@ -0,0 +1,167 @@
+// CCS PCH built-ins for host builds of the PMS firmware
+// Copyright 2016, McMaster Solar Car Project
+//
+// Provides the CCS integer types, the built-in functions used by the firmware
+// and a simulated special function register file. Output generated by
+// ccs2host.py includes this header first. Pin, ADC, delay and main loop
+// behaviour is forwarded to hook functions that the host program (replay
+// harness, benchmark) defines.
+
+#ifndef CCS_HOST_H
+#define CCS_HOST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// CCS integer types, "int" and the intN types are unsigned in CCS
+typedef bool     int1;
+typedef uint8_t  int8;
+typedef uint16_t int16;
+typedef uint32_t int32;
+typedef int8_t   sint8;
+typedef int16_t  sint16;
+typedef int32_t  sint32;
+
+#define TRUE  1
+#define FALSE 0
+
+// Simulated special function register file (0x000 - 0xFFF)
+extern int8 g_sfr[0x1000];
+
+// Single bit of a simulated register, used for #bit bindings
+struct ccs_bit
+{
+    int16 addr;
+    int8  bit;
+    operator bool() const { return (g_sfr[addr] >> bit) & 1; }
+    const ccs_bit & operator=(bool value) const
+    {
+        if (value) g_sfr[addr] |= (int8)(1 << bit);
+        else       g_sfr[addr] &= (int8)~(1 << bit);
+        return *this;
+    }
+};
+#define CCS_BIT(a,b) (ccs_bit{(a),(b)})
+
+// Whole byte access to a register declared as a struct of bit fields
+#define CCS_REGISTER_OPS                                                   \
+    operator int8() const { return *(const int8 *)this; }                  \
+    template <class T> void operator=(const T & value)                     \
+    {                                                                      \
+        *(int8 *)this = (int8)value;                                       \
+    }
+
+
+// Byte access helpers
+#define make8(x,n)       ((int8)((int32)(x) >> (8 * (n))))
+#define make16(h,l)      ((int16)(((int16)(int8)(h) << 8) | (int8)(l)))
+static inline int32 make32(int16 h, int16 l) { return ((int32)h << 16) | l; }
+static inline int32 make32(int8 a, int8 b, int8 c, int8 d)
+{
+    return ((int32)a << 24) | ((int32)b << 16) | ((int32)c << 8) | d;
+}
+#define bit_test(x,n)    ((((x) >> (n)) & 1) != 0)
+#define bit_set(x,n)     ((x) |= (1UL << (n)))
+#define bit_clear(x,n)   ((x) &= ~(1UL << (n)))
+#define ccs_getenv(s)    0
+
+// Pins are numbered port * 8 + bit, the same ordering as the device header
+enum
+{
+    PIN_A0 = 0, PIN_A1, PIN_A2, PIN_A3, PIN_A4, PIN_A5, PIN_A6, PIN_A7,
+    PIN_B0,     PIN_B1, PIN_B2, PIN_B3, PIN_B4, PIN_B5, PIN_B6, PIN_B7,
+    PIN_C0,     PIN_C1, PIN_C2, PIN_C3, PIN_C4, PIN_C5, PIN_C6, PIN_C7,
+    PIN_E3 = 35,
+    CCS_N_PINS = 40
+};
+
+// Hooks implemented by the host program
+void  ccs_pin_write(int8 pin, int1 value);
+int1  ccs_pin_read(int8 pin);
+int1  ccs_pin_latch(int8 pin);
+int16 ccs_read_adc(int8 channel);
+void  ccs_delay_us(int32 us);
+int1  ccs_host_loop(void);
+void  ccs_pwm_duty(int8 ccp, int16 duty);
+void  ccs_reset_cpu(void);
+
+#define output_high(p)      ccs_pin_write((p), 1)
+#define output_low(p)       ccs_pin_write((p), 0)
+#define output_bit(p,v)     ccs_pin_write((p), (v) != 0)
+#define output_toggle(p)    ccs_pin_write((p), !ccs_pin_latch(p))
+#define output_float(p)     ((void)(p))
+#define output_drive(p)     ((void)(p))
+#define input(p)            ccs_pin_read(p)
+#define input_state(p)      ccs_pin_read(p)
+
+#define delay_ms(n)         ccs_delay_us((int32)(n) * 1000)
+#define delay_us(n)         ccs_delay_us(n)
+#define delay_cycles(n)     ((void)(n))
+
+// ADC
+extern int8 g_ccs_adc_channel;
+#define ADC_CLOCK_INTERNAL  0
+#define ADC_OFF             0
+#define sAN0  0x0001
+#define sAN1  0x0002
+#define sAN2  0x0004
+#define sAN3  0x0008
+#define sAN4  0x0010
+#define sAN8  0x0100
+#define sAN9  0x0200
+#define sAN10 0x0400
+#define setup_adc(m)            ((void)(m))
+#define setup_adc_ports(m)      ((void)(m))
+#define set_adc_channel(c)      (g_ccs_adc_channel = (c))
+#define read_adc()              ccs_read_adc(g_ccs_adc_channel)
+
+// Interrupts, only the enable state is tracked
+enum
+{
+    GLOBAL = 0, INT_TIMER2, INT_CANRX0, INT_CANRX1, INT_CANTX0, INT_CANERR,
+    INT_TIMER0, INT_TIMER1, INT_TIMER3, INT_TIMER4, INT_RDA, INT_TBE, INT_EEPROM,
+    CCS_N_INTS
+};
+extern int1 g_ccs_int_enabled[CCS_N_INTS];
+#define enable_interrupts(i)    (g_ccs_int_enabled[i] = 1)
+#define disable_interrupts(i)   (g_ccs_int_enabled[i] = 0)
+#define clear_interrupt(i)      ((void)(i))
+#define interrupt_active(i)     ((void)(i), 0)
+
+// Timers, timer 1 does not count on the host
+#define T1_DISABLED   0
+#define T1_INTERNAL   0x07
+#define T1_DIV_BY_8   0x30
+#define setup_timer_1(mode)     ((void)(mode))
+#define set_timer1(v)           ((void)(v))
+#define get_timer1()            ((int16)0)
+#define T2_DISABLED   0
+#define T2_DIV_BY_1   1
+#define T2_DIV_BY_4   4
+#define T2_DIV_BY_16  16
+#define setup_timer_2(mode,period,postscale) ((void)(mode), (void)(period), (void)(postscale))
+
+// CCP modules, only PWM duty changes are passed to the host
+#define CCP_OFF       0
+#define CCP_PWM       0x0C
+#define setup_ccp2(m)           ((void)(m))
+#define set_pwm2_duty(d)        ccs_pwm_duty(2, (d))
+
+// Data EEPROM
+extern int8 g_ccs_eeprom[1024];
+#define read_eeprom(a)          (g_ccs_eeprom[(a) & 0x3FF])
+#define write_eeprom(a,v)       (g_ccs_eeprom[(a) & 0x3FF] = (v))
+
+// Reset causes, the host always starts from a power up
+#define WDT_TIMEOUT         7
+#define MCLR_FROM_SLEEP    11
+#define MCLR_FROM_RUN      15
+#define NORMAL_POWER_UP    12
+#define BROWNOUT_RESTART   14
+#define WDT_FROM_SLEEP      3
+#define RESET_INSTRUCTION   0
+#define restart_cause()         NORMAL_POWER_UP
+#define reset_cpu()             ccs_reset_cpu()
+
+#endif
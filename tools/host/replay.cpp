@@ -0,0 +1,623 @@
+// Deterministic replay of recorded bus logs through a host build of the PMS
+// Copyright 2016, McMaster Solar Car Project
+//
+// main.c is converted by ccs2host.py with the CAN driver replaced by
+// can_sim.h and linked against this harness. The harness owns a virtual
+// clock: delays and main loop iterations advance it, isr_timer2 runs on every
+// millisecond boundary, and recorded CAN frames, switch changes and ADC
+// readings are delivered at their recorded time. No wall clock is involved,
+// so a replay always produces the same output and runs as fast as the host
+// can execute the firmware.
+//
+// Input files are merged by timestamp, each line is one of:
+//   (1476735700.123456) can0 608#3A3B3C3D3E3F4041   CAN frame (candump -l)
+//   (1476735700.123456) pin PIN_B4 1                switch or input pin level
+//   (1476735700.123456) adc 10 183                  ADC channel reading
+// Lines that do not start with a timestamp are ignored.
+//
+// The timeline is written to stdout in the same format: frames sent by the
+// PMS appear as "pms ID#DATA" when they finish on the bus, output pin changes
+// as "pin NAME level" and PWM duty changes as "pwm CCPn duty". It can be
+// diffed against a known-good replay, or fed to tools/can_decode.c. A
+// reset_cpu call is shown as "reset" and ends the replay.
+//
+// Build (from the repository root):
+//   python3 tools/host/ccs2host.py main.c -o pms_host.cpp
+//       --replace can18F4580_mscp.c=can_sim.h
+//   g++ -O2 -std=gnu++17 -fpermissive -w -Itools/host -o pms_replay
+//       pms_host.cpp tools/host/replay.cpp
+// Usage: pms_replay [-e ms] [-l us] [-E image] log...
+//   -e ms     keep running for this long after the last event (default 2000)
+//   -l us     virtual time taken by one main loop iteration (default 20)
+//   -E image  data EEPROM contents, loaded before the replay if the file
+//             exists and saved after it, so the EEPROM log carries over
+//             between replays. The EEPROM starts erased otherwise.
+
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
+#include <vector>
+
+#include "can_sim.h"
+
+// Bus timing, 125 kbit/s as configured by can18F4580_mscp.h with a 20MHz clock
+#define CAN_SIM_BIT_US      8
+#define CAN_SIM_FRAME_BITS  47 // Overhead bits of a standard frame, bit stuffing is not modelled
+#define CAN_SIM_N_TX        3  // TXB0 - TXB2
+#define CAN_SIM_N_RX        2  // RXB0 - RXB1
+
+typedef unsigned long long sim_time_t; // Microseconds
+
+// Firmware entry points
+void ccs_main(void);
+void isr_timer2(void);
+void isr_canrx0(void);
+void isr_canrx1(void);
+
+int8 g_sfr[0x1000];
+int8 g_ccs_adc_channel;
+int1 g_ccs_int_enabled[CCS_N_INTS];
+int8 g_ccs_eeprom[1024];
+
+typedef enum
+{
+    EVENT_FRAME,
+    EVENT_PIN,
+    EVENT_ADC
+} event_type_t;
+
+typedef struct
+{
+    sim_time_t   time;
+    event_type_t type;
+    int32        id;    // Frame ID, pin number or ADC channel
+    int16        value; // Pin level or ADC reading
+    int8         len;
+    int8         data[8];
+} event_t;
+
+typedef struct
+{
+    int1  full;
+    int32 id;
+    int8  len;
+    int8  data[8];
+} frame_t;
+
+static std::vector<event_t> g_events;
+static size_t     g_next_event = 0;
+static sim_time_t g_now = 0;
+static sim_time_t g_next_tick = 0;
+static sim_time_t g_end = 0;
+static sim_time_t g_loop_us = 20;
+static int1       gb_timer2_pending = false;
+static int1       gb_in_isr = false;
+
+static int1  g_pins[CCS_N_PINS];
+static int16 g_adc[16];
+
+static frame_t    g_rx[CAN_SIM_N_RX];
+static frame_t    g_tx[CAN_SIM_N_TX];
+static sim_time_t g_tx_done[CAN_SIM_N_TX];
+static sim_time_t g_bus_free = 0;
+
+static unsigned long g_frames_in = 0;
+static unsigned long g_frames_lost = 0;
+static unsigned long g_frames_out = 0;
+
+//////////////////////////////
+// TIMELINE OUTPUT ///////////
+//////////////////////////////
+
+static void print_time(sim_time_t t)
+{
+    printf("(%llu.%06llu) ", t / 1000000, t % 1000000);
+}
+
+static const char * pin_name(int8 pin)
+{
+    static char name[8];
+    snprintf(name, sizeof(name), "PIN_%c%d", 'A' + pin / 8, pin % 8);
+    return name;
+}
+
+static int parse_pin(const char * name)
+{
+    if ((strncmp(name, "PIN_", 4) != 0) || (name[4] < 'A') || (name[4] > 'E') ||
+        (name[5] < '0') || (name[5] > '7'))
+    {
+        return -1;
+    }
+    return (name[4] - 'A') * 8 + (name[5] - '0');
+}
+
+//////////////////////////////
+// CCS HOOKS /////////////////
+//////////////////////////////
+
+static void advance(sim_time_t us);
+
+void ccs_pin_write(int8 pin, int1 value)
+{
+    if (g_pins[pin] != value)
+    {
+        print_time(g_now);
+        printf("pin %s %d\n", pin_name(pin), value);
+    }
+    g_pins[pin] = value;
+}
+
+void ccs_pwm_duty(int8 ccp, int16 duty)
+{
+    static int16 s_duty[8];
+
+    if (s_duty[ccp & 7] != duty)
+    {
+        print_time(g_now);
+        printf("pwm CCP%d %d\n", ccp, duty);
+    }
+    s_duty[ccp & 7] = duty;
+}
+
+int1 ccs_pin_read(int8 pin)
+{
+    return g_pins[pin];
+}
+
+int1 ccs_pin_latch(int8 pin)
+{
+    return g_pins[pin];
+}
+
+int16 ccs_read_adc(int8 channel)
+{
+    return g_adc[channel & 0x0F];
+}
+
+void ccs_delay_us(int32 us)
+{
+    advance(us);
+}
+
+// The bootloader is not part of the host build, a reset ends the replay
+void ccs_reset_cpu(void)
+{
+    print_time(g_now);
+    printf("reset\n");
+    g_end = g_now;
+}
+
+int1 ccs_host_loop(void)
+{
+    advance(g_loop_us);
+    return g_now < g_end;
+}
+
+//////////////////////////////
+// SIMULATED CAN DRIVER //////
+//////////////////////////////
+
+int1 can_init(void)
+{
+    return true;
+}
+
+int1 can_tbe(void)
+{
+    int i;
+    for (i = 0 ; i < CAN_SIM_N_TX ; i++)
+    {
+        if (!g_tx[i].full)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int1 can_kbhit(void)
+{
+    return g_rx[0].full || g_rx[1].full;
+}
+
+int8 can_putd(int32 id, int8 * data, int8 len, int8 priority, int1 ext, int1 rtr)
+{
+    int i;
+    (void)priority;
+    (void)ext;
+
+    for (i = 0 ; i < CAN_SIM_N_TX ; i++)
+    {
+        if (!g_tx[i].full)
+        {
+            break;
+        }
+    }
+    if (i == CAN_SIM_N_TX)
+    {
+        return 0xFF;
+    }
+
+    if (rtr || (data == NULL))
+    {
+        len = 0;
+    }
+    g_tx[i].full = true;
+    g_tx[i].id = id;
+    g_tx[i].len = len;
+    if (len > 0)
+    {
+        memcpy(g_tx[i].data, data, len);
+    }
+
+    // Frames go out one after another in the order they were queued
+    g_bus_free = std::max(g_bus_free, g_now) + (CAN_SIM_FRAME_BITS + 8 * len) * CAN_SIM_BIT_US;
+    g_tx_done[i] = g_bus_free;
+    return i;
+}
+
+int1 can_getd(int32 & id, int8 * data, int8 & len, struct rx_stat & stat)
+{
+    int i = g_rx[0].full ? 0 : 1;
+
+    if (!g_rx[i].full)
+    {
+        return false;
+    }
+    id = g_rx[i].id;
+    len = g_rx[i].len;
+    memcpy(data, g_rx[i].data, len);
+    memset(&stat, 0, sizeof(stat));
+    stat.buffer = i;
+    g_rx[i].full = false;
+    return true;
+}
+
+//////////////////////////////
+// VIRTUAL CLOCK /////////////
+//////////////////////////////
+
+static int1 interrupt_enabled(int8 irq)
+{
+    return g_ccs_int_enabled[GLOBAL] && g_ccs_int_enabled[irq];
+}
+
+static void deliver_event(const event_t & e)
+{
+    int i;
+
+    switch (e.type)
+    {
+        case EVENT_FRAME:
+            g_frames_in++;
+            // RXB0 is used first, RXB1 takes the frame if RXB0 is still full
+            for (i = 0 ; i < CAN_SIM_N_RX ; i++)
+            {
+                if (!g_rx[i].full)
+                {
+                    g_rx[i].full = true;
+                    g_rx[i].id = e.id;
+                    g_rx[i].len = e.len;
+                    memcpy(g_rx[i].data, e.data, 8);
+                    return;
+                }
+            }
+            g_frames_lost++;
+            break;
+        case EVENT_PIN:
+            g_pins[e.id] = e.value != 0;
+            break;
+        case EVENT_ADC:
+            g_adc[e.id & 0x0F] = e.value;
+            break;
+    }
+}
+
+static void complete_transmissions(void)
+{
+    int i;
+    int j;
+
+    // Report in completion order so the timeline is monotonic
+    for (;;)
+    {
+        j = -1;
+        for (i = 0 ; i < CAN_SIM_N_TX ; i++)
+        {
+            if (g_tx[i].full && (g_tx_done[i] <= g_now) && ((j < 0) || (g_tx_done[i] < g_tx_done[j])))
+            {
+                j = i;
+            }
+        }
+        if (j < 0)
+        {
+            return;
+        }
+        print_time(g_tx_done[j]);
+        printf("pms %03X#", g_tx[j].id);
+        for (i = 0 ; i < g_tx[j].len ; i++)
+        {
+            printf("%02X", g_tx[j].data[i]);
+        }
+        printf("\n");
+        g_tx[j].full = false;
+        g_frames_out++;
+    }
+}
+
+// Runs pending interrupt service routines in hardware priority order
+static void service_interrupts(void)
+{
+    if (gb_in_isr)
+    {
+        return;
+    }
+    gb_in_isr = true;
+    if (gb_timer2_pending && interrupt_enabled(INT_TIMER2))
+    {
+        gb_timer2_pending = false;
+        isr_timer2();
+    }
+    if (g_rx[0].full && interrupt_enabled(INT_CANRX0))
+    {
+        isr_canrx0();
+    }
+    if (g_rx[1].full && interrupt_enabled(INT_CANRX1))
+    {
+        isr_canrx1();
+    }
+    gb_in_isr = false;
+}
+
+// Moves the virtual clock forward, stopping at every tick, event and
+// transmission on the way
+static void advance(sim_time_t us)
+{
+    sim_time_t target = g_now + us;
+    sim_time_t next;
+    int i;
+
+    if (gb_in_isr)
+    {
+        // Delays inside an interrupt do not let other interrupts run
+        g_now = target;
+        return;
+    }
+
+    while (g_now < target)
+    {
+        next = std::min(target, g_next_tick);
+        if (g_next_event < g_events.size())
+        {
+            next = std::min(next, g_events[g_next_event].time);
+        }
+        for (i = 0 ; i < CAN_SIM_N_TX ; i++)
+        {
+            if (g_tx[i].full)
+            {
+                next = std::min(next, g_tx_done[i]);
+            }
+        }
+        g_now = std::max(g_now, next);
+
+        if (g_now >= g_next_tick)
+        {
+            g_next_tick += 1000;
+            gb_timer2_pending = true;
+        }
+        complete_transmissions();
+        service_interrupts();
+        while ((g_next_event < g_events.size()) && (g_events[g_next_event].time <= g_now))
+        {
+            deliver_event(g_events[g_next_event++]);
+            service_interrupts();
+        }
+    }
+}
+
+//////////////////////////////
+// LOG PARSING ///////////////
+//////////////////////////////
+
+static int hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    return -1;
+}
+
+// Parses "(sec.frac)" into microseconds, returns the rest of the line
+static const char * parse_time(const char * p, sim_time_t & t)
+{
+    sim_time_t frac = 0;
+    int digits = 0;
+
+    if (*p != '(')
+    {
+        return NULL;
+    }
+    t = strtoull(p + 1, (char **)&p, 10);
+    if (*p == '.')
+    {
+        for (p++ ; (*p >= '0') && (*p <= '9') ; p++)
+        {
+            if (digits < 6)
+            {
+                frac = frac * 10 + (*p - '0');
+                digits++;
+            }
+        }
+    }
+    for ( ; digits < 6 ; digits++)
+    {
+        frac *= 10;
+    }
+    if (*p != ')')
+    {
+        return NULL;
+    }
+    t = t * 1000000 + frac;
+    return p + 1;
+}
+
+static int1 parse_line(const char * line, event_t & e)
+{
+    char source[32];
+    char arg[32];
+    const char * p;
+    int value;
+    int h;
+    int l;
+
+    memset(&e, 0, sizeof(e));
+    p = parse_time(line, e.time);
+    if ((p == NULL) || (sscanf(p, "%31s %31s", source, arg) != 2))
+    {
+        return false;
+    }
+
+    if (strcmp(source, "pin") == 0)
+    {
+        if ((sscanf(p, "%*s %*s %d", &value) != 1) || (parse_pin(arg) < 0))
+        {
+            return false;
+        }
+        e.type = EVENT_PIN;
+        e.id = parse_pin(arg);
+        e.value = value;
+        return true;
+    }
+    if (strcmp(source, "adc") == 0)
+    {
+        if (sscanf(p, "%*s %*s %d", &value) != 1)
+        {
+            return false;
+        }
+        e.type = EVENT_ADC;
+        e.id = atoi(arg);
+        e.value = value;
+        return true;
+    }
+
+    // CAN frame, ID#DATA
+    e.type = EVENT_FRAME;
+    for (p = arg ; (h = hex_value(*p)) >= 0 ; p++)
+    {
+        e.id = (e.id << 4) | h;
+    }
+    if (*p++ != '#')
+    {
+        return false;
+    }
+    while ((e.len < 8) && ((h = hex_value(p[0])) >= 0) && ((l = hex_value(p[1])) >= 0))
+    {
+        e.data[e.len++] = (h << 4) | l;
+        p += 2;
+    }
+    return true;
+}
+
+static void load_log(const char * path)
+{
+    char line[256];
+    event_t e;
+    FILE * f = fopen(path, "r");
+
+    if (f == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (parse_line(line, e))
+        {
+            g_events.push_back(e);
+        }
+    }
+    fclose(f);
+}
+
+// Loads the data EEPROM from an image file, an EEPROM without one is erased
+static void load_eeprom(const char * path)
+{
+    FILE * f;
+
+    memset(g_ccs_eeprom, 0xFF, sizeof(g_ccs_eeprom));
+    f = (path != NULL) ? fopen(path, "rb") : NULL;
+    if (f != NULL)
+    {
+        fread(g_ccs_eeprom, 1, sizeof(g_ccs_eeprom), f);
+        fclose(f);
+    }
+}
+
+static void save_eeprom(const char * path)
+{
+    FILE * f = fopen(path, "wb");
+
+    if (f == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    fwrite(g_ccs_eeprom, 1, sizeof(g_ccs_eeprom), f);
+    fclose(f);
+}
+
+int main(int argc, char ** argv)
+{
+    sim_time_t extra_ms = 2000;
+    const char * eeprom = NULL;
+    int i;
+
+    for (i = 1 ; i < argc ; i++)
+    {
+        if ((strcmp(argv[i], "-e") == 0) && (i + 1 < argc))
+        {
+            extra_ms = strtoull(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "-l") == 0) && (i + 1 < argc))
+        {
+            g_loop_us = strtoull(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "-E") == 0) && (i + 1 < argc))
+        {
+            eeprom = argv[++i];
+        }
+        else
+        {
+            load_log(argv[i]);
+        }
+    }
+    if (g_events.empty())
+    {
+        fprintf(stderr, "usage: %s [-e ms] [-l us] [-E image] log...\n", argv[0]);
+        return 2;
+    }
+
+    // Merge the logs, events with the same time keep their file order
+    std::stable_sort(g_events.begin(), g_events.end(),
+                     [](const event_t & a, const event_t & b) { return a.time < b.time; });
+
+    // The PMS boots on the millisecond before the first event
+    g_now = g_events.front().time / 1000 * 1000;
+    g_next_tick = g_now + 1000;
+    g_end = g_events.back().time + extra_ms * 1000;
+
+    load_eeprom(eeprom);
+    auto start = std::chrono::steady_clock::now();
+    ccs_main();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double simulated = (g_now - g_events.front().time / 1000 * 1000) / 1e6;
+
+    if (eeprom != NULL)
+    {
+        save_eeprom(eeprom);
+    }
+    fflush(stdout);
+    fprintf(stderr, "replay: %.3f s simulated in %.3f s (%.0fx), %lu frames in, %lu lost, %lu frames out\n",
+            simulated, wall, (wall > 0) ? simulated / wall : 0.0, g_frames_in, g_frames_lost, g_frames_out);
+    return 0;
+}
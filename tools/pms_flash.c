@@ -0,0 +1,609 @@
+// Host-side PMS flasher
+// Copyright 2016, McMaster Solar Car Project
+// Loads a PMS application image over CAN bus through the bootloader
+// (bootloader.c), see pms_boot.h for the protocol. Runs on Linux with
+// SocketCAN, the interface has to be up at 125 kbit/s:
+//   ip link set can0 up type can bitrate 125000
+//
+// The image is the Intel HEX file of the application built by CCS. Only
+// BOOT_APP_START - BOOT_APP_END is loaded, a file with code below
+// BOOT_APP_START was not linked for the bootloader and is refused. The
+// configuration words and data EEPROM records are ignored, the loader cannot
+// change them. The image is padded with 0xFF to whole blocks and its CRC
+// checked by the PMS before the boot record is made valid.
+//
+// The PMS refuses to enter the loader while the motor relay is closed, turn
+// the motor switch off first. A session that fails once the loader is
+// running ends with BOOT_OP_RUN, so a PMS whose image was not touched goes
+// back to the application.
+//
+// Build: gcc -O2 -Wall -o pms_flash tools/pms_flash.c
+// Usage: pms_flash [-i interface] [-n] image.hex
+//   -i interface  CAN interface, can0 by default
+//   -n            dry run, print the frames that would be sent in candump -l
+//                 format and take every response as BOOT_OK
+
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include "../can_telem.h"
+#include "../pms_boot.h"
+
+#define APP_SIZE          (BOOT_APP_END - BOOT_APP_START + 1)
+#define LINE_LEN          600
+#define READY_TIMEOUT_MS  2000 // Reset into the loader and its READY
+#define FINISH_TIMEOUT_MS 2000 // CRC of the whole application area
+#define MAX_RETRIES       10   // Timeouts in a row before giving up
+#define ANY_OP            -1
+
+static unsigned char g_image[APP_SIZE];
+static unsigned      g_image_len = 0;
+static int           g_socket = -1;
+static int           g_dry_run = 0;
+
+static const char * g_status_name[] = {"ok", "bad key", "busy", "bad state", "bad block",
+                                       "incomplete", "bad crc", "bad op"};
+
+static const char * status_name(int status)
+{
+    if ((status >= 0) && (status < (int)(sizeof(g_status_name) / sizeof(g_status_name[0]))))
+    {
+        return g_status_name[status];
+    }
+    return "unknown";
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int hex_byte(const char * p)
+{
+    int i;
+    int v = 0;
+
+    for (i = 0 ; i < 2 ; i++)
+    {
+        v <<= 4;
+        if ((p[i] >= '0') && (p[i] <= '9'))
+        {
+            v |= p[i] - '0';
+        }
+        else if ((p[i] >= 'A') && (p[i] <= 'F'))
+        {
+            v |= p[i] - 'A' + 10;
+        }
+        else if ((p[i] >= 'a') && (p[i] <= 'f'))
+        {
+            v |= p[i] - 'a' + 10;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return v;
+}
+
+// Reads the Intel HEX file into g_image, returns 0 on success
+static int read_hex(const char * path)
+{
+    FILE *        in;
+    char          line[LINE_LEN];
+    unsigned char rec[LINE_LEN / 2];
+    unsigned      line_no = 0;
+    unsigned long base = 0;
+    unsigned long addr;
+    unsigned long end = 0;
+    int           len;
+    int           sum;
+    int           i;
+    int           v;
+
+    in = fopen(path, "r");
+    if (in == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    memset(g_image, 0xFF, sizeof(g_image));
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        line_no++;
+        if (line[0] != ':')
+        {
+            continue;
+        }
+
+        // Byte count, address, type, data, checksum
+        len = strcspn(line + 1, "\r\n") / 2;
+        sum = 0;
+        for (i = 0 ; i < len ; i++)
+        {
+            v = hex_byte(line + 1 + 2 * i);
+            if (v < 0)
+            {
+                break;
+            }
+            rec[i] = v;
+            sum += v;
+        }
+        if ((i != len) || (len < 5) || (rec[0] + 5 != len) || ((sum & 0xFF) != 0))
+        {
+            fprintf(stderr, "%s:%u: bad record\n", path, line_no);
+            fclose(in);
+            return -1;
+        }
+
+        switch(rec[3])
+        {
+            case 0x00:
+                for (i = 0 ; i < rec[0] ; i++)
+                {
+                    addr = base + ((rec[1] << 8) | rec[2]) + i;
+                    if (addr > BOOT_APP_END)
+                    {
+                        // Configuration words, ID locations or data EEPROM
+                        continue;
+                    }
+                    if (addr < BOOT_APP_START)
+                    {
+                        fprintf(stderr, "%s:%u: data at 0x%04lX, below the application area at 0x%04X,"
+                                " the image was not built for the bootloader\n",
+                                path, line_no, addr, BOOT_APP_START);
+                        fclose(in);
+                        return -1;
+                    }
+                    g_image[addr - BOOT_APP_START] = rec[4 + i];
+                    if (addr + 1 > end)
+                    {
+                        end = addr + 1;
+                    }
+                }
+                break;
+            case 0x01:
+                fclose(in);
+                if (end == 0)
+                {
+                    fprintf(stderr, "%s: no application code\n", path);
+                    return -1;
+                }
+                g_image_len = (end - BOOT_APP_START + BOOT_BLOCK_SIZE - 1) / BOOT_BLOCK_SIZE * BOOT_BLOCK_SIZE;
+                return 0;
+            case 0x02:
+                base = (unsigned long)((rec[4] << 8) | rec[5]) << 4;
+                break;
+            case 0x04:
+                base = (unsigned long)((rec[4] << 8) | rec[5]) << 16;
+                break;
+            default:
+                break;
+        }
+    }
+
+    fprintf(stderr, "%s: no end of file record\n", path);
+    fclose(in);
+    return -1;
+}
+
+// CRC-16/CCITT, the same as crc16 in bootloader.c
+static unsigned crc16(const unsigned char * data, unsigned len)
+{
+    unsigned crc = 0xFFFF;
+    unsigned i;
+    int      bit;
+
+    for (i = 0 ; i < len ; i++)
+    {
+        crc ^= data[i] << 8;
+        for (bit = 0 ; bit < 8 ; bit++)
+        {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc & 0xFFFF;
+}
+
+static int open_can(const char * ifname)
+{
+    struct sockaddr_can addr;
+    struct ifreq        ifr;
+    struct can_filter   filter;
+
+    g_socket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (g_socket < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(g_socket, SIOCGIFINDEX, &ifr) < 0)
+    {
+        perror(ifname);
+        return -1;
+    }
+
+    // Only the loader's responses
+    filter.can_id   = RESPONSE_PMS_BOOT_ID;
+    filter.can_mask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+    setsockopt(g_socket, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family  = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(g_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        return -1;
+    }
+    return 0;
+}
+
+// Sends a frame on COMMAND_PMS_BOOT, waits for room in the transmit queue
+static int send_frame(const unsigned char * data, int len)
+{
+    struct can_frame frame;
+    int              i;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id  = COMMAND_PMS_BOOT_ID;
+    frame.can_dlc = len;
+    memcpy(frame.data, data, len);
+
+    if (g_dry_run)
+    {
+        printf("(0.000000) can0 %03X#", COMMAND_PMS_BOOT_ID);
+        for (i = 0 ; i < len ; i++)
+        {
+            printf("%02X", data[i]);
+        }
+        printf("\n");
+        return 0;
+    }
+
+    while (write(g_socket, &frame, sizeof(frame)) != sizeof(frame))
+    {
+        if (errno != ENOBUFS)
+        {
+            perror("write");
+            return -1;
+        }
+        usleep(1000);
+    }
+    return 0;
+}
+
+// Waits up to timeout_ms for a response to op (or ANY_OP), fills status, arg
+// and, if not NULL, data with the whole response
+// Returns 1 for a response, 0 for a timeout and -1 for an error
+static int wait_response(int op, int timeout_ms, int * status, int * arg, unsigned char * data)
+{
+    struct can_frame frame;
+    struct pollfd    pfd;
+    long long        deadline = now_ms() + timeout_ms;
+    long long        left;
+
+    if (g_dry_run)
+    {
+        *status = BOOT_OK;
+        *arg    = 0;
+        if (data != NULL)
+        {
+            data[0] = (op == ANY_OP) ? BOOT_OP_READY : op;
+            data[2] = BOOT_VERSION;
+            data[3] = BOOT_REASON_REQUEST;
+            data[4] = BOOT_BLOCK_SIZE;
+        }
+        return 1;
+    }
+
+    pfd.fd     = g_socket;
+    pfd.events = POLLIN;
+    while ((left = deadline - now_ms()) > 0)
+    {
+        if (poll(&pfd, 1, left) <= 0)
+        {
+            continue;
+        }
+        if (read(g_socket, &frame, sizeof(frame)) != sizeof(frame))
+        {
+            perror("read");
+            return -1;
+        }
+        if ((frame.can_id != RESPONSE_PMS_BOOT_ID) || (frame.can_dlc < 2) || ((op != ANY_OP) && (frame.data[0] != op)))
+        {
+            continue;
+        }
+        *status = frame.data[1];
+        *arg    = (frame.can_dlc >= 4) ? (frame.data[2] | (frame.data[3] << 8)) : 0;
+        if (data != NULL)
+        {
+            memcpy(data, frame.data, frame.can_dlc);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Asks the loader to restart after a failed session, the application starts
+// again if the update had not invalidated it yet
+static void leave_loader(void)
+{
+    unsigned char frame[1];
+
+    frame[0] = BOOT_OP_RUN;
+    send_frame(frame, 1);
+}
+
+// Sends a command and waits for its response, retrying on timeouts
+// Returns the status or -1
+static int command(const unsigned char * data, int len, int op, int timeout_ms, int * arg,
+                   unsigned char * response)
+{
+    int retries;
+    int status;
+    int result;
+
+    for (retries = 0 ; retries < MAX_RETRIES ; retries++)
+    {
+        if (send_frame(data, len) < 0)
+        {
+            return -1;
+        }
+        result = wait_response(op, timeout_ms, &status, arg, response);
+        if (result < 0)
+        {
+            return -1;
+        }
+        if (result > 0)
+        {
+            return status;
+        }
+    }
+    fprintf(stderr, "no response from the PMS\n");
+    return -1;
+}
+
+static int send_block(unsigned block)
+{
+    unsigned char frame[8];
+    const unsigned char * data = g_image + block * BOOT_BLOCK_SIZE;
+    int           n;
+
+    frame[0] = BOOT_OP_DATA;
+    frame[1] = block & 0xFF;
+    frame[2] = block >> 8;
+    memcpy(frame + 3, data, 5);
+    if (send_frame(frame, 8) < 0)
+    {
+        return -1;
+    }
+    for (n = 1 ; n < BOOT_BLOCK_FRAMES ; n++)
+    {
+        // The last frame runs past the end of the block, its tail is padding
+        frame[0] = BOOT_OP_DATA | n;
+        memset(frame + 1, 0xFF, 7);
+        memcpy(frame + 1, data + 7 * n - 2, (BOOT_BLOCK_SIZE - (7 * n - 2) < 7) ? (BOOT_BLOCK_SIZE - (7 * n - 2)) : 7);
+        if (send_frame(frame, 8) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Sends every block, BOOT_WINDOW ahead of the acknowledgements, going back to
+// the oldest block not acknowledged after a refusal or a timeout
+static int send_image(void)
+{
+    unsigned n_blocks = g_image_len / BOOT_BLOCK_SIZE;
+    unsigned base = 0;
+    unsigned next = 0;
+    int      retries = 0;
+    int      status;
+    int      arg;
+    int      result;
+
+    while (base < n_blocks)
+    {
+        while ((next < n_blocks) && (next < base + BOOT_WINDOW))
+        {
+            if (send_block(next++) < 0)
+            {
+                return -1;
+            }
+        }
+
+        result = wait_response(BOOT_OP_DATA, BOOT_ACK_TIMEOUT_MS, &status, &arg, NULL);
+        if (result < 0)
+        {
+            return -1;
+        }
+        if (result == 0)
+        {
+            if (++retries >= MAX_RETRIES)
+            {
+                fprintf(stderr, "block %u not acknowledged\n", base);
+                return -1;
+            }
+            next = base;
+            continue;
+        }
+        if (g_dry_run)
+        {
+            arg = base;
+        }
+        if ((unsigned)arg < base)
+        {
+            // Late answer to a block already sent again
+            continue;
+        }
+
+        switch(status)
+        {
+            case BOOT_OK:
+                if ((unsigned)arg > base)
+                {
+                    // The loader drops a block whose frame 0 was lost without
+                    // answering, so a later block acknowledged first means
+                    // base was not written
+                    if (++retries >= MAX_RETRIES)
+                    {
+                        fprintf(stderr, "\nblock %u not acknowledged\n", base);
+                        return -1;
+                    }
+                    next = base;
+                    break;
+                }
+                base    = arg + 1;
+                retries = 0;
+                if (next < base)
+                {
+                    next = base;
+                }
+                fprintf(stderr, "\r%u/%u blocks", base, n_blocks);
+                break;
+            case BOOT_INCOMPLETE:
+                next = base;
+                break;
+            default:
+                fprintf(stderr, "\nblock %d refused: %s\n", arg, status_name(status));
+                return -1;
+        }
+    }
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    const char *  ifname = "can0";
+    const char *  path = NULL;
+    unsigned char frame[8];
+    unsigned char response[8];
+    unsigned      crc;
+    int           status;
+    int           arg;
+    int           i;
+
+    for (i = 1 ; i < argc ; i++)
+    {
+        if ((strcmp(argv[i], "-i") == 0) && (i + 1 < argc))
+        {
+            ifname = argv[++i];
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            g_dry_run = 1;
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if (path == NULL)
+    {
+        fprintf(stderr, "usage: %s [-i interface] [-n] image.hex\n", argv[0]);
+        return 1;
+    }
+
+    if (read_hex(path) < 0)
+    {
+        return 1;
+    }
+    crc = crc16(g_image, g_image_len);
+    fprintf(stderr, "%s: %u bytes, %u blocks, crc 0x%04X\n", path, g_image_len,
+            g_image_len / BOOT_BLOCK_SIZE, crc);
+
+    if ((g_dry_run == 0) && (open_can(ifname) < 0))
+    {
+        return 1;
+    }
+
+    // Into the loader, a PMS already in it answers BOOT_OP_ENTER with READY
+    frame[0] = BOOT_OP_ENTER;
+    frame[1] = BOOT_KEY & 0xFF;
+    frame[2] = BOOT_KEY >> 8;
+    if (send_frame(frame, 3) < 0)
+    {
+        return 1;
+    }
+    do
+    {
+        if (wait_response(ANY_OP, READY_TIMEOUT_MS, &status, &arg, response) <= 0)
+        {
+            fprintf(stderr, "the PMS bootloader did not answer\n");
+            return 1;
+        }
+        if ((response[0] == BOOT_OP_ENTER) && (status != BOOT_OK))
+        {
+            fprintf(stderr, "PMS refused the update: %s%s\n", status_name(status),
+                    (status == BOOT_BUSY) ? ", turn the motor off" : "");
+            return 1;
+        }
+    } while (response[0] != BOOT_OP_READY);
+    if (response[2] != BOOT_VERSION)
+    {
+        fprintf(stderr, "bootloader version %d, expected %d\n", response[2], BOOT_VERSION);
+        leave_loader();
+        return 1;
+    }
+    fprintf(stderr, "bootloader version %d, reason %d\n", response[2], response[3]);
+
+    frame[0] = BOOT_OP_START;
+    frame[1] = g_image_len & 0xFF;
+    frame[2] = g_image_len >> 8;
+    frame[3] = crc & 0xFF;
+    frame[4] = crc >> 8;
+    status = command(frame, 5, BOOT_OP_START, BOOT_ACK_TIMEOUT_MS, &arg, NULL);
+    if (status != BOOT_OK)
+    {
+        fprintf(stderr, "start refused: %s\n", status_name(status));
+        leave_loader();
+        return 1;
+    }
+
+    if (send_image() < 0)
+    {
+        leave_loader();
+        return 1;
+    }
+
+    frame[0] = BOOT_OP_FINISH;
+    status = command(frame, 1, BOOT_OP_FINISH, FINISH_TIMEOUT_MS, &arg, NULL);
+    if (status != BOOT_OK)
+    {
+        fprintf(stderr, "finish refused: %s, PMS crc 0x%04X\n", status_name(status), arg);
+        leave_loader();
+        return 1;
+    }
+
+    frame[0] = BOOT_OP_RUN;
+    status = command(frame, 1, BOOT_OP_RUN, BOOT_ACK_TIMEOUT_MS, &arg, NULL);
+    if (status != BOOT_OK)
+    {
+        fprintf(stderr, "run refused: %s\n", status_name(status));
+        return 1;
+    }
+    fprintf(stderr, "done\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Generator for the DC/DC thermistor table in pms_dcdc_table.h
+// Copyright 2016, McMaster Solar Car Project
+// Computes the temperature at evenly spaced readings of the 12-bit ADC from
+// the Beta equation of the thermistor, 1/T = 1/T25 + ln(R/R25)/B, and prints
+// the table in tenths of a degree C. The firmware interpolates between the
+// entries, so a conversion is a lookup, a multiply and a shift.
+//
+// The thermistor sits between the input and ground with a pull-up resistor
+// to the ADC reference. Change the THERM_xxx defines to match the board, then
+// regenerate the header:
+//
+// Build: gcc -O2 -o therm_table tools/therm_table.c -lm
+// Usage: therm_table > pms_dcdc_table.h
+
+#include <math.h>
+#include <stdio.h>
+
+#define THERM_R25        10000.0 // Thermistor resistance at 25 degrees C, ohms
+#define THERM_BETA        3435.0 // Beta coefficient, K
+#define THERM_PULL_UP    10000.0 // Pull-up resistance, ohms
+#define THERM_MIN_DC      -400   // Coldest temperature in the table, 0.1 degrees C
+#define THERM_MAX_DC      1500   // Hottest temperature in the table, 0.1 degrees C
+
+#define ADC_COUNTS        4096   // 12-bit ADC
+#define TABLE_SHIFT          6   // Readings between entries, as a power of 2
+#define TABLE_LEN         ((ADC_COUNTS >> TABLE_SHIFT) + 1)
+
+#define KELVIN_25          298.15
+
+// Temperature in tenths of a degree C at an ADC reading, clamped to the table range
+static int temperature(int reading)
+{
+    double r;
+    double t;
+    int    dc;
+
+    if (reading <= 0)
+    {
+        return THERM_MAX_DC;
+    }
+    if (reading >= ADC_COUNTS)
+    {
+        return THERM_MIN_DC;
+    }
+
+    r  = THERM_PULL_UP * reading / (ADC_COUNTS - reading);
+    t  = 1.0 / (1.0 / KELVIN_25 + log(r / THERM_R25) / THERM_BETA) - 273.15;
+    dc = (int)lround(t * 10.0);
+    if (dc > THERM_MAX_DC)
+    {
+        dc = THERM_MAX_DC;
+    }
+    if (dc < THERM_MIN_DC)
+    {
+        dc = THERM_MIN_DC;
+    }
+    return dc;
+}
+
+int main(void)
+{
+    int i;
+
+    printf("#ifndef PMS_DCDC_TABLE_H\n");
+    printf("#define PMS_DCDC_TABLE_H\n\n");
+    printf("// DC/DC thermistor table, generated by tools/therm_table.c, do not edit\n");
+    printf("// %.0f ohm NTC, B = %.0fK, to ground with a %.0f ohm pull-up\n",
+           THERM_R25, THERM_BETA, THERM_PULL_UP);
+    printf("// Entry n is the temperature in 0.1 degrees C at reading n << DCDC_TABLE_SHIFT\n\n");
+    printf("#define DCDC_TABLE_SHIFT %d\n", TABLE_SHIFT);
+    printf("#define DCDC_TABLE_LEN   %d\n\n", TABLE_LEN);
+    printf("static const signed int16 g_dcdc_table[DCDC_TABLE_LEN] =\n{\n");
+    for (i = 0 ; i < TABLE_LEN ; i++)
+    {
+        if ((i % 8) == 0)
+        {
+            printf("   ");
+        }
+        printf(" %5d%s", temperature(i << TABLE_SHIFT), (i < TABLE_LEN - 1) ? "," : "");
+        if (((i % 8) == 7) || (i == TABLE_LEN - 1))
+        {
+            printf("\n");
+        }
+    }
+    printf("};\n\n#endif\n");
+    return 0;
+}